@@ -0,0 +1,671 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmstat.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/rbtree.h>
+#include <linux/xarray.h>
+#include <linux/maple_tree.h>
+#include <linux/math64.h>
+
+#include "egoist.h"
+
+#define ADT_MAX_RESULTS     64
+#define ADT_RESCHED_MASK    1023    /* cond_resched() every 1024 ops */
+
+/*
+ * Every ADT runs the same workload on keys 0..n-1: insert them in random
+ * order, look up a random sample, walk random [lo, lo + range_len) windows,
+ * then erase a random sample. Timings come out in ns/op, range walks in ns
+ * per visited element.
+ */
+struct adt_bench {
+    u64 n;
+    u64 *keys;              /* insertion order */
+    u64 *probe;             /* lookup/erase order */
+    void *nodes;            /* n nodes of ops->node_size */
+
+    struct list_head list;
+    struct hlist_head *buckets;
+    unsigned int bits;
+    struct rb_root rb;
+    struct xarray xa;
+    struct maple_tree mt;
+};
+
+struct adt_ops {
+    const char *name;
+    size_t node_size;
+    bool linear;            /* O(n) lookups, only a small sample is timed */
+    int (*setup)(struct adt_bench *b);
+    int (*insert)(struct adt_bench *b, u64 i);
+    bool (*lookup)(struct adt_bench *b, u64 key);
+    bool (*erase)(struct adt_bench *b, u64 key);
+    u64 (*range)(struct adt_bench *b, u64 lo, u64 hi);
+    void (*teardown)(struct adt_bench *b);
+};
+
+struct adt_result {
+    const char *name;
+    u64 n;
+    u64 insert_ps;          /* picoseconds per op, printed as ns.xxx */
+    u64 lookup_ps;
+    u64 range_ps;
+    u64 erase_ps;
+    u64 bytes_x100;         /* bytes per element, times 100 */
+};
+
+typedef struct _egoist {
+    struct ego_core core;
+    struct mutex lock;      /* one run at a time, guards results */
+    u64 nr_elems;
+    u32 max_ops;
+    u32 linear_ops;
+    u32 range_ops;
+    u32 range_len;
+    struct adt_result results[ADT_MAX_RESULTS];
+    unsigned int nr_results;
+}egoist, *pegoist;
+pegoist chip;
+
+#define adt_node(b, type, i)    \
+    ((type *)((b)->nodes + (i) * sizeof(type)))
+
+/* list_head */
+
+struct adt_list_node {
+    struct list_head node;
+    u64 key;
+};
+
+static int adt_list_setup(struct adt_bench *b)
+{
+    INIT_LIST_HEAD(&b->list);
+    return 0;
+}
+
+static int adt_list_insert(struct adt_bench *b, u64 i)
+{
+    struct adt_list_node *e = adt_node(b, struct adt_list_node, i);
+
+    e->key = b->keys[i];
+    list_add_tail(&e->node, &b->list);
+    return 0;
+}
+
+static struct adt_list_node *adt_list_find(struct adt_bench *b, u64 key)
+{
+    struct adt_list_node *e;
+
+    list_for_each_entry(e, &b->list, node) {
+        if (e->key == key)
+            return e;
+    }
+    return NULL;
+}
+
+static bool adt_list_lookup(struct adt_bench *b, u64 key)
+{
+    return adt_list_find(b, key) != NULL;
+}
+
+static bool adt_list_erase(struct adt_bench *b, u64 key)
+{
+    struct adt_list_node *e = adt_list_find(b, key);
+
+    if (e)
+        list_del(&e->node);
+    return e != NULL;
+}
+
+static u64 adt_list_range(struct adt_bench *b, u64 lo, u64 hi)
+{
+    struct adt_list_node *e;
+    u64 visited = 0;
+
+    list_for_each_entry(e, &b->list, node) {
+        if (e->key >= lo && e->key < hi)
+            visited++;
+    }
+    return visited;
+}
+
+static void adt_list_teardown(struct adt_bench *b)
+{
+    INIT_LIST_HEAD(&b->list);
+}
+
+/* hlist buckets, hash_64() as in hashtable.h but sized at run time */
+
+struct adt_hash_node {
+    struct hlist_node node;
+    u64 key;
+};
+
+static int adt_hash_setup(struct adt_bench *b)
+{
+    u64 i;
+
+    b->bits = max_t(unsigned int, ilog2(roundup_pow_of_two(b->n)), 1);
+    b->buckets = kvmalloc_array(1UL << b->bits, sizeof(*b->buckets), GFP_KERNEL);
+    if (!b->buckets)
+        return -ENOMEM;
+
+    for (i = 0; i < (1UL << b->bits); i++)
+        INIT_HLIST_HEAD(&b->buckets[i]);
+    return 0;
+}
+
+static int adt_hash_insert(struct adt_bench *b, u64 i)
+{
+    struct adt_hash_node *e = adt_node(b, struct adt_hash_node, i);
+
+    e->key = b->keys[i];
+    hlist_add_head(&e->node, &b->buckets[hash_64(e->key, b->bits)]);
+    return 0;
+}
+
+static struct adt_hash_node *adt_hash_find(struct adt_bench *b, u64 key)
+{
+    struct adt_hash_node *e;
+
+    hlist_for_each_entry(e, &b->buckets[hash_64(key, b->bits)], node) {
+        if (e->key == key)
+            return e;
+    }
+    return NULL;
+}
+
+static bool adt_hash_lookup(struct adt_bench *b, u64 key)
+{
+    return adt_hash_find(b, key) != NULL;
+}
+
+static bool adt_hash_erase(struct adt_bench *b, u64 key)
+{
+    struct adt_hash_node *e = adt_hash_find(b, key);
+
+    if (e)
+        hlist_del(&e->node);
+    return e != NULL;
+}
+
+/* No order in a hash table, a range is one lookup per key */
+static u64 adt_hash_range(struct adt_bench *b, u64 lo, u64 hi)
+{
+    u64 key, visited = 0;
+
+    for (key = lo; key < hi; key++)
+        visited += adt_hash_lookup(b, key);
+    return visited;
+}
+
+static void adt_hash_teardown(struct adt_bench *b)
+{
+    kvfree(b->buckets);
+    b->buckets = NULL;
+}
+
+/* rbtree */
+
+struct adt_rb_node {
+    struct rb_node node;
+    u64 key;
+};
+
+#define adt_rb_key(n)   rb_entry((n), struct adt_rb_node, node)->key
+
+static bool adt_rb_less(struct rb_node *a, const struct rb_node *b)
+{
+    return adt_rb_key(a) < adt_rb_key(b);
+}
+
+static int adt_rb_cmp(const void *key, const struct rb_node *n)
+{
+    u64 k = *(const u64 *)key;
+
+    if (k < adt_rb_key(n))
+        return -1;
+    return k > adt_rb_key(n);
+}
+
+static int adt_rb_setup(struct adt_bench *b)
+{
+    b->rb = RB_ROOT;
+    return 0;
+}
+
+static int adt_rb_insert(struct adt_bench *b, u64 i)
+{
+    struct adt_rb_node *e = adt_node(b, struct adt_rb_node, i);
+
+    e->key = b->keys[i];
+    rb_add(&e->node, &b->rb, adt_rb_less);
+    return 0;
+}
+
+static bool adt_rb_lookup(struct adt_bench *b, u64 key)
+{
+    return rb_find(&key, &b->rb, adt_rb_cmp) != NULL;
+}
+
+static bool adt_rb_erase(struct adt_bench *b, u64 key)
+{
+    struct rb_node *n = rb_find(&key, &b->rb, adt_rb_cmp);
+
+    if (n)
+        rb_erase(n, &b->rb);
+    return n != NULL;
+}
+
+static u64 adt_rb_range(struct adt_bench *b, u64 lo, u64 hi)
+{
+    struct rb_node *n = b->rb.rb_node, *first = NULL;
+    u64 visited = 0;
+
+    /* Lower bound: leftmost node with key >= lo */
+    while (n) {
+        if (adt_rb_key(n) >= lo) {
+            first = n;
+            n = n->rb_left;
+        } else {
+            n = n->rb_right;
+        }
+    }
+
+    for (n = first; n && adt_rb_key(n) < hi; n = rb_next(n))
+        visited++;
+    return visited;
+}
+
+static void adt_rb_teardown(struct adt_bench *b)
+{
+    b->rb = RB_ROOT;
+}
+
+/* xarray and maple tree store a pointer to the key */
+
+static int adt_xa_setup(struct adt_bench *b)
+{
+    xa_init(&b->xa);
+    return 0;
+}
+
+static int adt_xa_insert(struct adt_bench *b, u64 i)
+{
+    return xa_err(xa_store(&b->xa, b->keys[i], &b->keys[i], GFP_KERNEL));
+}
+
+static bool adt_xa_lookup(struct adt_bench *b, u64 key)
+{
+    return xa_load(&b->xa, key) != NULL;
+}
+
+static bool adt_xa_erase(struct adt_bench *b, u64 key)
+{
+    return xa_erase(&b->xa, key) != NULL;
+}
+
+static u64 adt_xa_range(struct adt_bench *b, u64 lo, u64 hi)
+{
+    unsigned long index;
+    u64 visited = 0;
+    void *entry;
+
+    xa_for_each_range(&b->xa, index, entry, lo, hi - 1)
+        visited++;
+    return visited;
+}
+
+static void adt_xa_teardown(struct adt_bench *b)
+{
+    xa_destroy(&b->xa);
+}
+
+static int adt_mt_setup(struct adt_bench *b)
+{
+    mt_init(&b->mt);
+    return 0;
+}
+
+static int adt_mt_insert(struct adt_bench *b, u64 i)
+{
+    return mtree_insert(&b->mt, b->keys[i], &b->keys[i], GFP_KERNEL);
+}
+
+static bool adt_mt_lookup(struct adt_bench *b, u64 key)
+{
+    return mtree_load(&b->mt, key) != NULL;
+}
+
+static bool adt_mt_erase(struct adt_bench *b, u64 key)
+{
+    return mtree_erase(&b->mt, key) != NULL;
+}
+
+static u64 adt_mt_range(struct adt_bench *b, u64 lo, u64 hi)
+{
+    unsigned long index = lo;
+    u64 visited = 0;
+    void *entry;
+
+    mt_for_each(&b->mt, entry, index, hi - 1)
+        visited++;
+    return visited;
+}
+
+static void adt_mt_teardown(struct adt_bench *b)
+{
+    mtree_destroy(&b->mt);
+}
+
+static const struct adt_ops adt_all[] = {
+    {
+        .name = "list", .node_size = sizeof(struct adt_list_node), .linear = true,
+        .setup = adt_list_setup, .insert = adt_list_insert,
+        .lookup = adt_list_lookup, .erase = adt_list_erase,
+        .range = adt_list_range, .teardown = adt_list_teardown,
+    },
+    {
+        .name = "hash", .node_size = sizeof(struct adt_hash_node),
+        .setup = adt_hash_setup, .insert = adt_hash_insert,
+        .lookup = adt_hash_lookup, .erase = adt_hash_erase,
+        .range = adt_hash_range, .teardown = adt_hash_teardown,
+    },
+    {
+        .name = "rbtree", .node_size = sizeof(struct adt_rb_node),
+        .setup = adt_rb_setup, .insert = adt_rb_insert,
+        .lookup = adt_rb_lookup, .erase = adt_rb_erase,
+        .range = adt_rb_range, .teardown = adt_rb_teardown,
+    },
+    {
+        .name = "xarray", .node_size = 0,
+        .setup = adt_xa_setup, .insert = adt_xa_insert,
+        .lookup = adt_xa_lookup, .erase = adt_xa_erase,
+        .range = adt_xa_range, .teardown = adt_xa_teardown,
+    },
+    {
+        .name = "maple", .node_size = 0,
+        .setup = adt_mt_setup, .insert = adt_mt_insert,
+        .lookup = adt_mt_lookup, .erase = adt_mt_erase,
+        .range = adt_mt_range, .teardown = adt_mt_teardown,
+    },
+};
+
+/* Slab pages in use, xarray and maple nodes come from there */
+static u64 adt_slab_bytes(void)
+{
+    return (global_node_page_state_pages(NR_SLAB_RECLAIMABLE_B) +
+        global_node_page_state_pages(NR_SLAB_UNRECLAIMABLE_B)) << PAGE_SHIFT;
+}
+
+static void adt_shuffle(u64 *keys, u64 n)
+{
+    u64 i, j;
+
+    for (i = 0; i < n; i++)
+        keys[i] = i;
+    for (i = n - 1; i > 0; i--) {
+        j = get_random_u32_below(i + 1);
+        swap(keys[i], keys[j]);
+        if (!(i & ADT_RESCHED_MASK))
+            cond_resched();
+    }
+}
+
+static inline u64 adt_ps_per_op(u64 ns, u64 ops)
+{
+    return ops ? div64_u64(ns * 1000, ops) : 0;
+}
+
+static int adt_run_one(pegoist chip, struct adt_bench *b, const struct adt_ops *ops,
+        struct adt_result *res)
+{
+    u64 i, nr, visited, lo, t0, slab0, slab1;
+    int ret = 0;
+    u32 span = max(chip->range_len, 1U);
+    /* A linear lookup walks up to n nodes, so give the CPU back after each */
+    u64 resched = ops->linear ? 0 : ADT_RESCHED_MASK;
+
+    memset(res, 0, sizeof(*res));
+    res->name = ops->name;
+    res->n = b->n;
+
+    ret = ops->setup(b);
+    if (ret)
+        return ret;
+
+    /* Insert */
+    slab0 = adt_slab_bytes();
+    t0 = ktime_get_ns();
+    for (i = 0; i < b->n; i++) {
+        ret = ops->insert(b, i);
+        if (ret)
+            break;
+        if (!(i & ADT_RESCHED_MASK))
+            cond_resched();
+    }
+    res->insert_ps = adt_ps_per_op(ktime_get_ns() - t0, i);
+    if (ret) {
+        ops->teardown(b);
+        return ret;
+    }
+
+    slab1 = ops->node_size ? slab0 : max(adt_slab_bytes(), slab0);
+    res->bytes_x100 = div64_u64((ops->node_size * b->n + slab1 - slab0 +
+                (b->buckets ? sizeof(*b->buckets) << b->bits : 0)) * 100, b->n);
+
+    /* Lookup */
+    nr = min_t(u64, b->n, ops->linear ? chip->linear_ops : chip->max_ops);
+    t0 = ktime_get_ns();
+    for (i = 0; i < nr; i++) {
+        if (!ops->lookup(b, b->probe[i]))
+            ret = -ENOENT;
+        if (!(i & resched))
+            cond_resched();
+    }
+    res->lookup_ps = adt_ps_per_op(ktime_get_ns() - t0, nr);
+
+    /* Range */
+    nr = ops->linear ? min(chip->range_ops, 16U) : chip->range_ops;
+    visited = 0;
+    t0 = ktime_get_ns();
+    for (i = 0; i < nr; i++) {
+        lo = get_random_u32_below(b->n);
+        visited += ops->range(b, lo, lo + span);
+        if (!(i & resched))
+            cond_resched();
+    }
+    res->range_ps = adt_ps_per_op(ktime_get_ns() - t0, visited);
+
+    /* Erase */
+    nr = min_t(u64, b->n, ops->linear ? chip->linear_ops : chip->max_ops);
+    t0 = ktime_get_ns();
+    for (i = 0; i < nr; i++) {
+        if (!ops->erase(b, b->probe[i]))
+            ret = -ENOENT;
+        if (!(i & resched))
+            cond_resched();
+    }
+    res->erase_ps = adt_ps_per_op(ktime_get_ns() - t0, nr);
+
+    ops->teardown(b);
+    if (ret)
+        ego_err(chip, "%s lost keys\n", ops->name);
+    return ret;
+}
+
+static int adt_run(pegoist chip, const char *which)
+{
+    struct adt_bench b = { .n = clamp_t(u64, chip->nr_elems, 1, U32_MAX) };
+    struct adt_result res;
+    size_t node_max = 0;
+    int i, ret = 0;
+
+    for (i = 0; i < ARRAY_SIZE(adt_all); i++)
+        node_max = max(node_max, adt_all[i].node_size);
+
+    b.keys = kvmalloc_array(b.n, sizeof(u64), GFP_KERNEL);
+    b.probe = kvmalloc_array(b.n, sizeof(u64), GFP_KERNEL);
+    b.nodes = kvmalloc_array(b.n, node_max, GFP_KERNEL);
+    if (!b.keys || !b.probe || !b.nodes) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    adt_shuffle(b.keys, b.n);
+    adt_shuffle(b.probe, b.n);
+
+    for (i = 0; i < ARRAY_SIZE(adt_all); i++) {
+        if (strcmp(which, "all") && strcmp(which, adt_all[i].name))
+            continue;
+
+        ret = adt_run_one(chip, &b, &adt_all[i], &res);
+        if (ret)
+            break;
+
+        chip->results[chip->nr_results++ % ADT_MAX_RESULTS] = res;
+        ego_info(chip, "%s n=%llu done\n", res.name, res.n);
+    }
+out:
+    kvfree(b.nodes);
+    kvfree(b.probe);
+    kvfree(b.keys);
+    return ret;
+}
+
+static ssize_t adt_run_write(struct file *filp, const char __user *buf,
+        size_t size, loff_t *pos)
+{
+    pegoist dev = filp->private_data;
+    char which[16];
+    int ret;
+
+    if (size >= sizeof(which))
+        return -EINVAL;
+    if (copy_from_user(which, buf, size))
+        return -EFAULT;
+    which[size] = '\0';
+    strim(which);
+
+    mutex_lock(&dev->lock);
+    ret = adt_run(dev, which[0] ? which : "all");
+    mutex_unlock(&dev->lock);
+
+    return ret ? ret : size;
+}
+
+static const struct file_operations adt_run_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = adt_run_write,
+};
+
+/* " <v / div>.<v % div>", div_u64_rem() so 32-bit needs no libgcc helpers */
+static void adt_put_fixed(struct seq_file *m, u64 v, u32 div, int width)
+{
+    u32 rem;
+    u64 q = div_u64_rem(v, div, &rem);
+
+    seq_printf(m, " %llu.%0*u", q, width, rem);
+}
+
+static int adt_results_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct adt_result *r;
+    unsigned int i, first;
+
+    seq_puts(m, "adt elems insert_ns lookup_ns range_ns_per_elem erase_ns bytes_per_elem\n");
+
+    mutex_lock(&dev->lock);
+    first = dev->nr_results > ADT_MAX_RESULTS ? dev->nr_results - ADT_MAX_RESULTS : 0;
+    for (i = first; i < dev->nr_results; i++) {
+        r = &dev->results[i % ADT_MAX_RESULTS];
+        seq_printf(m, "%s %llu", r->name, r->n);
+        adt_put_fixed(m, r->insert_ps, 1000, 3);
+        adt_put_fixed(m, r->lookup_ps, 1000, 3);
+        adt_put_fixed(m, r->range_ps, 1000, 3);
+        adt_put_fixed(m, r->erase_ps, 1000, 3);
+        adt_put_fixed(m, r->bytes_x100, 100, 2);
+        seq_putc(m, '\n');
+    }
+    mutex_unlock(&dev->lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(adt_results);
+
+EGO_DEFINE_RELEASE(ego_free, egoist)
+
+void ego_release(pegoist chip)
+{
+    if (chip != NULL) {
+        ego_core_put(&chip->core);
+    } else {
+        pr_err("Failed to alloc mem for egoist\n");
+    }
+}
+
+static int __init ego_adt_init(void)
+{
+    int ret = 0;
+
+    do {
+        chip = kzalloc(sizeof(*chip), GFP_KERNEL);
+        if (!chip) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        ret = ego_core_setup(&chip->core, "ego_adt", ego_free);
+        if (ret)
+            break;
+        mutex_init(&chip->lock);
+        chip->nr_elems = 1000;
+        chip->max_ops = 1000000;
+        chip->linear_ops = 1000;
+        chip->range_ops = 1000;
+        chip->range_len = 64;
+
+        debugfs_create_u64("nr_elems", 0644, chip->core.dir, &chip->nr_elems);
+        debugfs_create_u32("max_ops", 0644, chip->core.dir, &chip->max_ops);
+        debugfs_create_u32("linear_ops", 0644, chip->core.dir, &chip->linear_ops);
+        debugfs_create_u32("range_ops", 0644, chip->core.dir, &chip->range_ops);
+        debugfs_create_u32("range_len", 0644, chip->core.dir, &chip->range_len);
+        debugfs_create_file("run", 0200, chip->core.dir, chip, &adt_run_fops);
+        debugfs_create_file("results", 0444, chip->core.dir, chip, &adt_results_fops);
+
+    } while (0);
+
+    if (ret) {
+        ego_release(chip);
+        return ret;
+    }
+
+    ego_info(chip, "All things goes well, awesome\n");
+    return ret;
+}
+
+static void __exit ego_adt_exit(void)
+{
+    ego_release(chip);
+    pr_info("All things gone\n");
+}
+
+module_init(ego_adt_init);
+module_exit(ego_adt_exit);
+
+MODULE_AUTHOR("Manfred <1259106665@qq.com>");
+MODULE_LICENSE("GPL");
@@ -8,44 +8,125 @@
 #include <linux/completion.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/random.h>
 
-static bool debug_option = true;    /* hard-code control */
+#include "egoist.h"
+#include "ego_stats.h"
+#include "ego_trace.h"
+#include "ego_cpu.h"
+#include "ego_wheel.h"
 
-#define ego_err(chip, fmt, ...)     \
-    pr_err("%s: %s " fmt, chip->name,   \
-        __func__, ##__VA__ARGS__)
+#define EGO_DEMO_TIMEOUT    (10 * HZ)
+#define WAIT_MAX_WAITERS    10000
+#define WAIT_MAX_RESULTS    128
+#define WAIT_MAX_TIMEOUT_MS 3600000
 
-#define ego_info(chip, fmt, ...)    \
-    do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_info("%s: %s " fmt, chip->name, \
-                __func__, ##__VA_ARGS__);       \
-        else                                    \
-            ;   \
-    } while(0)
-
-typedef struct _egoist {
-    char *name;
-    struct completion ack;
-    struct delayed_work thread_wake;
+/* The waiters of one node and what wakes them, allocated there */
+struct ego_completion_node {
     struct task_struct *thread_waiter_1;
     struct task_struct *thread_waiter_2;
-    bool debug_on;
+    int nid;
+    /* Queued and run by the workqueue */
+    struct delayed_work thread_wake EGO_HOT;
+    /* Waiters and the completer fight over them */
+    struct ego_waiter waiter_1 EGO_HOT;
+    struct ego_waiter waiter_2;
+};
+
+/*
+ * One waiter of the benchmark. A share of them is woken at a random point
+ * within timeout_max_ms, the rest and whoever is woken too late time out.
+ */
+struct wait_bench {
+    struct ego_waiter w;
+    struct task_struct *task;
+    u32 timeout_ms;
+    bool woken;
+    u64 wake_at_ns;             /* U64_MAX for never */
+    u64 deadline_ns;
+    u64 return_ns;
+    int status;
+};
+
+struct wait_result {
+    unsigned int waiters;
+    u32 timeout_min_ms;
+    u32 timeout_max_ms;
+    u32 wake_pct;
+    u64 wakes;
+    u64 timeouts;
+    u64 cancels;
+    u64 wake_avg_ns;            /* from ego_wait_wake() to the waiter running */
+    u64 wake_max_ns;
+    u64 late_avg_ns;            /* from the deadline to the waiter running */
+    u64 late_max_ns;
+};
+
+typedef struct _egoist {
+    struct ego_core core;
+    struct ego_stat *stat_wakeups;
+    struct ego_stat *stat_wait;
+    struct ego_stat *stat_timeouts;
+    struct ego_stat *stat_wake;
+    struct ego_stat *stat_late;
+    struct ego_cpuhp hp;
+    struct ego_completion_node **nodes;
+
+    /* Wait service benchmark, one run at a time */
+    struct mutex run_lock;      /* guards results */
+    u32 timeout_min_ms;
+    u32 timeout_max_ms;
+    u32 wake_pct;
+    struct wait_bench *bench;
+    unsigned int nr_bench;
+    atomic_t bench_queued;
+    struct completion bench_ready;
+    atomic_t bench_left;
+    struct completion bench_done;
+    struct wait_result results[WAIT_MAX_RESULTS];
+    unsigned int nr_results;
+
+    /* The demo waiters and the benchmark each get a wheel of their own */
+    struct ego_wheel wheel EGO_HOT;
+    struct ego_wheel bench_wheel EGO_HOT;
 }egoist, *pegoist;
 pegoist chip;
 
+static void ego_free(struct ego_core *core)
+{
+    pegoist chip = container_of(core, egoist, core);
+
+    kfree(chip->nodes);
+    kfree(chip);
+}
+
+static void ego_completion_stop(struct ego_completion_node *cn)
+{
+    cancel_delayed_work_sync(&cn->thread_wake);
+    /* A waiter the work never got to would block kthread_stop() */
+    ego_wait_cancel(&chip->wheel, &cn->waiter_1);
+    ego_wait_cancel(&chip->wheel, &cn->waiter_2);
+    if (!IS_ERR_OR_NULL(cn->thread_waiter_1)) {
+        kthread_stop(cn->thread_waiter_1);
+    }
+
+    if (!IS_ERR_OR_NULL(cn->thread_waiter_2)) {
+        kthread_stop(cn->thread_waiter_2);
+    }
+}
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        cancel_delayed_work(&chip->thread_wake);
-        if (!IS_ERR_OR_NULL(chip->thread_waiter_1)) {
-            kthread_stop(chip->thread_waiter_1);
-        }
-
-        if (!IS_ERR_OR_NULL(chip->thread_waiter_2)) {
-            kthread_stop(chip->thread_waiter_2);
-        }
-        kfree(chip);
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
@@ -53,39 +134,380 @@ void ego_release(pegoist chip)
 
 static void wake_handle(struct work_struct *work)
 {
-    pegoist dev = container_of(work, egoist, thread_wake.work);
+    struct ego_completion_node *cn = container_of(work, struct ego_completion_node,
+            thread_wake.work);
 
-    ego_info(dev, "Enter and ready to use complete\n");
-    complete(&dev->ack);
+    ego_info(chip, "Enter node %d and ready to use complete\n", cn->nid);
+    trace_ego_completion_complete(chip->core.name);
+    ego_record(chip, EGO_FLIGHT_COMPLETE, cn->nid, 0, 0);
+    ego_wait_wake(&chip->wheel, &cn->waiter_1);
     mdelay(2000);
-    ego_info(dev, "The second time\n");
-    complete(&dev->ack);
+    ego_info(chip, "The second time\n");
+    trace_ego_completion_complete(chip->core.name);
+    ego_record(chip, EGO_FLIGHT_COMPLETE, cn->nid, 0, 0);
+    ego_wait_wake(&chip->wheel, &cn->waiter_2);
 }
 
 static int waiter_1_thread(void *arg)
 {
-    ego_info(chip, "Enter\n");
-    wait_for_completion(&chip->ack);
-    ego_info(chip, "Exit\n");
+    struct ego_completion_node *cn = arg;
+    u64 t0 = ktime_get_ns(), waited;
+    int ret;
 
-    while(!kthread_should_stop())
-        ;
+    ego_info(chip, "Enter on node %d\n", cn->nid);
+    trace_ego_completion_wait(chip->core.name, 1);
+    ret = ego_wait_timeout(&chip->wheel, &cn->waiter_1, EGO_DEMO_TIMEOUT);
+    waited = ktime_get_ns() - t0;
+    trace_ego_completion_wake(chip->core.name, 1, waited);
+    ego_count(chip, events);
+    ego_counter_inc(ret == -ETIMEDOUT ? chip->stat_timeouts : chip->stat_wakeups);
+    ego_hist_record(chip->stat_wait, waited);
+    ego_record(chip, EGO_FLIGHT_WAKE, 1, waited, 0);
+    ego_info(chip, "Exit, ret=%d\n", ret);
+
+    /* Nothing left to do, sleep until we are stopped */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
 
     return 0;
 }
 
 static int waiter_2_thread(void *arg)
 {
-    ego_info(chip, "Enter\n");
-    wait_for_completion(&chip->ack);
-    ego_info(chip, "Exit\n");
+    struct ego_completion_node *cn = arg;
+    u64 t0 = ktime_get_ns(), waited;
+    int ret;
+
+    ego_info(chip, "Enter on node %d\n", cn->nid);
+    trace_ego_completion_wait(chip->core.name, 2);
+    ret = ego_wait_timeout(&chip->wheel, &cn->waiter_2, EGO_DEMO_TIMEOUT);
+    waited = ktime_get_ns() - t0;
+    trace_ego_completion_wake(chip->core.name, 2, waited);
+    ego_count(chip, events);
+    ego_counter_inc(ret == -ETIMEDOUT ? chip->stat_timeouts : chip->stat_wakeups);
+    ego_hist_record(chip->stat_wait, waited);
+    ego_record(chip, EGO_FLIGHT_WAKE, 2, waited, 0);
+    ego_info(chip, "Exit, ret=%d\n", ret);
+
+    /* Nothing left to do, sleep until we are stopped */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
+
+    return 0;
+}
+
+static int wait_bench_thread(void *data)
+{
+    struct wait_bench *b = data;
+    int ret;
+
+    b->deadline_ns = ktime_get_ns() + (u64)b->timeout_ms * NSEC_PER_MSEC;
+    ret = ego_wait_queue(&chip->bench_wheel, &b->w, msecs_to_jiffies(b->timeout_ms));
 
-    while(!kthread_should_stop())
-        ;
+    /* The waker holds off until the last of us is on the wheel */
+    if (atomic_dec_and_test(&chip->bench_queued))
+        complete(&chip->bench_ready);
+    if (ret == -EINPROGRESS)
+        ret = ego_wait_for(&chip->bench_wheel, &b->w);
+    b->status = ret;
+    b->return_ns = ktime_get_ns();
+    if (atomic_dec_and_test(&chip->bench_left))
+        complete(&chip->bench_done);
+
+    /* Stay around until the runner collected us */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
 
     return 0;
 }
 
+/* Plays the requests that do complete, roughly once per millisecond */
+static int wait_waker_thread(void *data)
+{
+    pegoist chip = data;
+    struct wait_bench *b;
+    unsigned int i, left;
+    u64 now;
+
+    do {
+        left = 0;
+        now = ktime_get_ns();
+        for (i = 0; i < chip->nr_bench; i++) {
+            b = &chip->bench[i];
+            if (b->woken || b->wake_at_ns == U64_MAX)
+                continue;
+            if (b->wake_at_ns > now) {
+                left++;
+                continue;
+            }
+            ego_wait_wake(&chip->bench_wheel, &b->w);
+            b->woken = true;
+        }
+        usleep_range(1000, 1100);
+    } while (left && !kthread_should_stop());
+
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
+
+    return 0;
+}
+
+static int wait_run(pegoist chip, unsigned int nr)
+{
+    struct ego_wheel *wh = &chip->bench_wheel;
+    struct task_struct *waker;
+    struct wait_result r;
+    struct wait_bench *b;
+    u64 t0, wake_ns = 0, late_ns = 0, d;
+    unsigned int started = 0, i;
+    u32 span = chip->timeout_max_ms - chip->timeout_min_ms + 1;
+    int ret = 0;
+
+    chip->bench = kvcalloc(nr, sizeof(*chip->bench), GFP_KERNEL);
+    if (!chip->bench)
+        return -ENOMEM;
+    chip->nr_bench = nr;
+    atomic_set(&chip->bench_queued, nr);
+    init_completion(&chip->bench_ready);
+    atomic_set(&chip->bench_left, nr);
+    init_completion(&chip->bench_done);
+
+    /* Wake points are offsets until every waiter is queued */
+    for (i = 0; i < nr; i++) {
+        b = &chip->bench[i];
+        ego_waiter_init(&b->w);
+        b->timeout_ms = chip->timeout_min_ms + get_random_u32_below(span);
+        b->wake_at_ns = U64_MAX;
+        if (get_random_u32_below(100) < chip->wake_pct)
+            b->wake_at_ns = (u64)get_random_u32_below(chip->timeout_max_ms *
+                    USEC_PER_MSEC + 1) * NSEC_PER_USEC;
+    }
+
+    for (i = 0; i < nr; i++) {
+        b = &chip->bench[i];
+        b->task = kthread_run(wait_bench_thread, b, "ego_wait/%u", i);
+        if (IS_ERR(b->task)) {
+            ret = PTR_ERR(b->task);
+            b->task = NULL;
+            break;
+        }
+        started++;
+    }
+
+    /* Whoever never got a thread is not waited for */
+    if (started < nr) {
+        if (atomic_sub_and_test(nr - started, &chip->bench_queued))
+            complete(&chip->bench_ready);
+        if (atomic_sub_and_test(nr - started, &chip->bench_left))
+            complete(&chip->bench_done);
+    }
+
+    /*
+     * A wake that beats its waiter onto the wheel would return at once and
+     * pass for a fast one, so the waker only starts once all are queued.
+     */
+    wait_for_completion(&chip->bench_ready);
+    t0 = ktime_get_ns();
+    for (i = 0; i < nr; i++) {
+        b = &chip->bench[i];
+        if (b->wake_at_ns != U64_MAX)
+            b->wake_at_ns += t0;
+    }
+
+    waker = kthread_run(wait_waker_thread, chip, "ego_wait_waker");
+    if (IS_ERR(waker)) {
+        if (!ret)
+            ret = PTR_ERR(waker);
+        waker = NULL;
+    } else if (!wait_for_completion_timeout(&chip->bench_done,
+            msecs_to_jiffies(chip->timeout_max_ms) + 10 * HZ) && !ret) {
+        ret = -ETIMEDOUT;
+    }
+
+    /* Bulk cancellation, anything still queued goes home now */
+    ego_wheel_cancel_all(wh);
+    wait_for_completion(&chip->bench_done);
+    if (waker)
+        kthread_stop(waker);
+
+    memset(&r, 0, sizeof(r));
+    for (i = 0; i < started; i++) {
+        b = &chip->bench[i];
+        kthread_stop(b->task);
+        switch (b->status) {
+        case 0:
+            d = b->return_ns > b->w.woken_ns ? b->return_ns - b->w.woken_ns : 0;
+            r.wakes++;
+            wake_ns += d;
+            r.wake_max_ns = max(r.wake_max_ns, d);
+            ego_hist_record(chip->stat_wake, d);
+            break;
+        case -ETIMEDOUT:
+            d = b->return_ns > b->deadline_ns ? b->return_ns - b->deadline_ns : 0;
+            r.timeouts++;
+            late_ns += d;
+            r.late_max_ns = max(r.late_max_ns, d);
+            ego_hist_record(chip->stat_late, d);
+            ego_counter_inc(chip->stat_timeouts);
+            break;
+        default:
+            r.cancels++;
+            break;
+        }
+    }
+
+    if (!ret) {
+        r.waiters = started;
+        r.timeout_min_ms = chip->timeout_min_ms;
+        r.timeout_max_ms = chip->timeout_max_ms;
+        r.wake_pct = chip->wake_pct;
+        r.wake_avg_ns = r.wakes ? div64_u64(wake_ns, r.wakes) : 0;
+        r.late_avg_ns = r.timeouts ? div64_u64(late_ns, r.timeouts) : 0;
+        chip->results[chip->nr_results++ % WAIT_MAX_RESULTS] = r;
+        ego_info(chip, "waiters:%u wakes:%llu timeouts:%llu done\n", started,
+                r.wakes, r.timeouts);
+    }
+
+    kvfree(chip->bench);
+    chip->bench = NULL;
+    chip->nr_bench = 0;
+    return ret;
+}
+
+/* Write a number of waiters to run them all against the wheel */
+static ssize_t wait_run_write(struct file *filp, const char __user *buf,
+        size_t size, loff_t *pos)
+{
+    pegoist dev = filp->private_data;
+    unsigned int nr;
+    int ret;
+
+    ret = kstrtouint_from_user(buf, size, 0, &nr);
+    if (ret)
+        return ret;
+
+    mutex_lock(&dev->run_lock);
+    if (!nr || nr > WAIT_MAX_WAITERS || dev->wake_pct > 100 ||
+            dev->timeout_min_ms > dev->timeout_max_ms ||
+            dev->timeout_max_ms > WAIT_MAX_TIMEOUT_MS)
+        ret = -EINVAL;
+    else
+        ret = wait_run(dev, nr);
+    mutex_unlock(&dev->run_lock);
+
+    return ret ? ret : size;
+}
+
+static const struct file_operations wait_run_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = wait_run_write,
+};
+
+static int wait_results_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct wait_result *r;
+    unsigned int i, first;
+
+    seq_puts(m, "waiters timeout_min_ms timeout_max_ms wake_pct wakes timeouts cancels wake_avg_ns wake_max_ns late_avg_ns late_max_ns\n");
+
+    mutex_lock(&dev->run_lock);
+    first = dev->nr_results > WAIT_MAX_RESULTS ? dev->nr_results - WAIT_MAX_RESULTS : 0;
+    for (i = first; i < dev->nr_results; i++) {
+        r = &dev->results[i % WAIT_MAX_RESULTS];
+        seq_printf(m, "%u %u %u %u %llu %llu %llu %llu %llu %llu %llu\n", r->waiters,
+                r->timeout_min_ms, r->timeout_max_ms, r->wake_pct, r->wakes,
+                r->timeouts, r->cancels, r->wake_avg_ns, r->wake_max_ns,
+                r->late_avg_ns, r->late_max_ns);
+    }
+    mutex_unlock(&dev->run_lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wait_results);
+
+/* What the wheels did so far */
+static int wait_wheels_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct ego_wheel *wheels[] = { &dev->wheel, &dev->bench_wheel };
+    static const char * const names[] = { "demo", "bench" };
+    struct ego_wheel *wh;
+    int i;
+
+    seq_puts(m, "wheel pending wakes timeouts cancels\n");
+    for (i = 0; i < ARRAY_SIZE(wheels); i++) {
+        wh = wheels[i];
+        spin_lock_bh(&wh->lock);
+        seq_printf(m, "%s %u %llu %llu %llu\n", names[i], wh->pending, wh->wakes,
+                wh->timeouts, wh->cancels);
+        spin_unlock_bh(&wh->lock);
+    }
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wait_wheels);
+
+/*
+ * Runs on the first CPU of @nid to come up, so the wake work is queued
+ * there and the waiters stay on the node.
+ */
+static int ego_completion_node_online(struct ego_cpuhp *hp, int nid)
+{
+    pegoist chip = container_of(hp, egoist, hp);
+    struct ego_completion_node *cn;
+    int ret = 0;
+
+    cn = kzalloc_node(sizeof(*cn), GFP_KERNEL, nid);
+    if (!cn)
+        return -ENOMEM;
+
+    cn->nid = nid;
+    ego_waiter_init(&cn->waiter_1);
+    ego_waiter_init(&cn->waiter_2);
+    INIT_DELAYED_WORK(&cn->thread_wake, wake_handle);
+    cn->thread_waiter_1 = ego_kthread_run_on_node(waiter_1_thread, cn, nid, "waiter_1");
+    cn->thread_waiter_2 = ego_kthread_run_on_node(waiter_2_thread, cn, nid, "waiter_2");
+    if (IS_ERR(cn->thread_waiter_1) || IS_ERR(cn->thread_waiter_2)) {
+        ret = IS_ERR(cn->thread_waiter_1) ? PTR_ERR(cn->thread_waiter_1) :
+                PTR_ERR(cn->thread_waiter_2);
+        ego_completion_stop(cn);
+        kfree(cn);
+        return ret;
+    }
+    chip->nodes[nid] = cn;
+    schedule_delayed_work(&cn->thread_wake, 0 * HZ);
+
+    return ret;
+}
+
+/* Runs after the last CPU of @nid went down */
+static void ego_completion_node_offline(struct ego_cpuhp *hp, int nid)
+{
+    pegoist chip = container_of(hp, egoist, hp);
+    struct ego_completion_node *cn = chip->nodes[nid];
+
+    ego_completion_stop(cn);
+    chip->nodes[nid] = NULL;
+    kfree(cn);
+}
 
 static int __init ego_completion_init(void)
 {
@@ -94,27 +516,58 @@ static int __init ego_completion_init(void)
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
 
-        chip->name = "egoist";
-        chip->debug_on = true;
-        init_completion(&chip->ack); /* Initialize a completon */
-        INIT_DELAYED_WORK(&chip->thread_wake, wake_handle);
-        chip->thread_waiter_1 = kthread_run(waiter_1_thread, NULL, "waiter_1");
-        mdelay(1000);
-        chip->thread_waiter_2 = kthread_run(waiter_2_thread, NULL, "waiter_2");
+        ret = ego_core_setup(&chip->core, "egoist", ego_free);
+        if (ret)
+            break;
+        chip->stat_wakeups = ego_counter_create(chip->core.stats, "wakeups");
+        chip->stat_wait = ego_hist_create(chip->core.stats, "wait_ns");
+        chip->stat_timeouts = ego_counter_create(chip->core.stats, "timeouts");
+        chip->stat_wake = ego_hist_create(chip->core.stats, "wake_ns");
+        chip->stat_late = ego_hist_create(chip->core.stats, "timeout_late_ns");
+        mutex_init(&chip->run_lock);
+        chip->timeout_min_ms = 10;
+        chip->timeout_max_ms = 1000;
+        chip->wake_pct = 50;
 
-    } while (0);
+        /* Stopped after the nodes are gone, which cancel their own waiters */
+        ego_wheel_init(&chip->wheel);
+        ret = ego_core_add_action(&chip->core, ego_wheel_stop, &chip->wheel);
+        if (ret)
+            break;
+        ego_wheel_init(&chip->bench_wheel);
+        ret = ego_core_add_action(&chip->core, ego_wheel_stop, &chip->bench_wheel);
+        if (ret)
+            break;
 
-    schedule_delayed_work(&chip->thread_wake, 0 * HZ);
+        chip->nodes = kcalloc(nr_node_ids, sizeof(*chip->nodes), GFP_KERNEL);
+        if (!chip->nodes) {
+            ret = -ENOMEM;
+            break;
+        }
+        chip->hp.node_online = ego_completion_node_online;
+        chip->hp.node_offline = ego_completion_node_offline;
+        ret = ego_cpuhp_add(&chip->core, &chip->hp);
+        if (ret)
+            break;
+
+        debugfs_create_u32("timeout_min_ms", 0644, chip->core.dir, &chip->timeout_min_ms);
+        debugfs_create_u32("timeout_max_ms", 0644, chip->core.dir, &chip->timeout_max_ms);
+        debugfs_create_u32("wake_pct", 0644, chip->core.dir, &chip->wake_pct);
+        debugfs_create_file("run", 0200, chip->core.dir, chip, &wait_run_fops);
+        debugfs_create_file("results", 0444, chip->core.dir, chip, &wait_results_fops);
+        debugfs_create_file("wheels", 0444, chip->core.dir, chip, &wait_wheels_fops);
+
+    } while (0);
 
     if (ret) {
         ego_release(chip);
         return ret;
     }
-    
+
     ego_info(chip, "All things goes well, awesome\n");
     return ret;
 }
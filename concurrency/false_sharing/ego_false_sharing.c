@@ -0,0 +1,346 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kthread.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+
+#include "egoist.h"
+
+/* The egoist as every module used to lay it out: config and hot state packed */
+struct fs_packed {
+    char *name;
+    bool debug_on;
+    spinlock_t lock;
+    unsigned long share_data;
+    atomic_long_t events;
+};
+
+/* The egoist on top of ego_core: config, hot state and per-CPU counters apart */
+struct fs_split {
+    struct ego_core core;
+    spinlock_t lock EGO_HOT;
+    unsigned long share_data;
+};
+
+enum {
+    FS_PACKED = 0,
+    FS_SPLIT,
+    FS_NR_LAYOUTS,
+};
+
+static const char * const fs_layout_name[FS_NR_LAYOUTS] = {
+    [FS_PACKED] = "packed",
+    [FS_SPLIT] = "split",
+};
+
+struct fs_worker {
+    struct task_struct *task;
+    int layout;
+    bool writer;
+    u64 ops;
+    u64 ns;
+} ____cacheline_aligned_in_smp;
+
+struct fs_result {
+    u64 reader_ops;
+    u64 reader_ns;
+    u64 writer_ops;
+    u64 writer_ns;
+    unsigned int readers;
+    unsigned int writers;
+};
+
+typedef struct _egoist {
+    struct ego_core core;
+    struct mutex lock;          /* one run at a time, guards results */
+    u32 duration_ms;
+    u32 nr_writers;
+    u32 nr_threads;
+
+    struct fs_packed *packed;
+    struct fs_split *split;
+    struct fs_worker *workers;
+
+    /* Start handshake; workers sleep on it instead of spinning */
+    struct completion ready;
+    struct completion start;
+    /* Stop flag polled by all workers, kept off the shared data */
+    bool stop EGO_HOT;
+
+    struct fs_result results[FS_NR_LAYOUTS];
+}egoist, *pegoist;
+pegoist chip;
+
+/* What ego_info() does before it prints: look at the config */
+static __always_inline bool fs_packed_read(struct fs_packed *p)
+{
+    bool on = READ_ONCE(p->debug_on) && READ_ONCE(p->name);
+
+    atomic_long_inc(&p->events);
+    return on;
+}
+
+static __always_inline bool fs_split_read(struct fs_split *s)
+{
+    bool on = READ_ONCE(s->core.debug_on) && READ_ONCE(s->core.name);
+
+    this_cpu_inc(s->core.counters->events);
+    return on;
+}
+
+static int fs_worker_thread(void *data)
+{
+    struct fs_worker *w = data;
+    struct fs_packed *p = chip->packed;
+    struct fs_split *s = chip->split;
+    unsigned long flags;
+    u64 ops = 0, t0;
+
+    complete(&chip->ready);
+    wait_for_completion(&chip->start);
+
+    t0 = ktime_get_ns();
+    while (!READ_ONCE(chip->stop)) {
+        if (w->writer && w->layout == FS_PACKED) {
+            spin_lock_irqsave(&p->lock, flags);
+            p->share_data++;
+            spin_unlock_irqrestore(&p->lock, flags);
+        } else if (w->writer) {
+            spin_lock_irqsave(&s->lock, flags);
+            s->share_data++;
+            spin_unlock_irqrestore(&s->lock, flags);
+        } else if (w->layout == FS_PACKED) {
+            fs_packed_read(p);
+        } else {
+            fs_split_read(s);
+        }
+
+        if (!(++ops & 1023))
+            cond_resched();
+    }
+    w->ns = ktime_get_ns() - t0;
+    w->ops = ops;
+
+    /* Stay around until the runner collected us */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
+
+    return 0;
+}
+
+static int fs_run_layout(pegoist chip, int layout)
+{
+    struct fs_result *res = &chip->results[layout];
+    struct fs_worker *w;
+    unsigned int nr = 0, i;
+    int cpu, ret = 0;
+
+    reinit_completion(&chip->ready);
+    reinit_completion(&chip->start);
+    WRITE_ONCE(chip->stop, false);
+    memset(chip->workers, 0, sizeof(*chip->workers) * nr_cpu_ids);
+
+    cpus_read_lock();
+    for_each_online_cpu(cpu) {
+        if (nr >= chip->nr_threads)
+            break;
+
+        w = &chip->workers[nr];
+        w->layout = layout;
+        w->writer = nr < chip->nr_writers;
+        w->task = kthread_create(fs_worker_thread, w, "ego_fs/%d", cpu);
+        if (IS_ERR(w->task)) {
+            ret = PTR_ERR(w->task);
+            w->task = NULL;
+            break;
+        }
+        kthread_bind(w->task, cpu);
+        nr++;
+    }
+    cpus_read_unlock();
+
+    for (i = 0; i < nr; i++)
+        wake_up_process(chip->workers[i].task);
+
+    if (!ret) {
+        for (i = 0; i < nr; i++)
+            wait_for_completion(&chip->ready);
+        complete_all(&chip->start);
+        msleep(chip->duration_ms);
+    }
+    complete_all(&chip->start);
+    WRITE_ONCE(chip->stop, true);
+
+    memset(res, 0, sizeof(*res));
+    for (i = 0; i < nr; i++) {
+        w = &chip->workers[i];
+        kthread_stop(w->task);
+        if (w->writer) {
+            res->writers++;
+            res->writer_ops += w->ops;
+            res->writer_ns += w->ns;
+        } else {
+            res->readers++;
+            res->reader_ops += w->ops;
+            res->reader_ns += w->ns;
+        }
+    }
+
+    return ret;
+}
+
+static ssize_t fs_run_write(struct file *filp, const char __user *buf,
+        size_t size, loff_t *pos)
+{
+    pegoist dev = filp->private_data;
+    int layout, ret = 0;
+
+    mutex_lock(&dev->lock);
+    for (layout = 0; layout < FS_NR_LAYOUTS && !ret; layout++)
+        ret = fs_run_layout(dev, layout);
+    mutex_unlock(&dev->lock);
+
+    return ret ? ret : size;
+}
+
+static const struct file_operations fs_run_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = fs_run_write,
+};
+
+/* Million ops per second over all threads of a role */
+static u64 fs_mops(u64 ops, u64 ns, unsigned int threads)
+{
+    return ns ? div64_u64(ops * 1000 * threads, ns) : 0;
+}
+
+static int fs_results_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct fs_result *r;
+    int layout;
+
+    seq_puts(m, "layout readers reader_mops reader_ns_per_op writers writer_mops writer_ns_per_op\n");
+
+    mutex_lock(&dev->lock);
+    for (layout = 0; layout < FS_NR_LAYOUTS; layout++) {
+        r = &dev->results[layout];
+        seq_printf(m, "%s %u %llu %llu %u %llu %llu\n", fs_layout_name[layout],
+                r->readers, fs_mops(r->reader_ops, r->reader_ns, r->readers),
+                r->reader_ops ? div64_u64(r->reader_ns, r->reader_ops) : 0,
+                r->writers, fs_mops(r->writer_ops, r->writer_ns, r->writers),
+                r->writer_ops ? div64_u64(r->writer_ns, r->writer_ops) : 0);
+    }
+    mutex_unlock(&dev->lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fs_results);
+
+EGO_DEFINE_RELEASE(fs_split_free, struct fs_split)
+
+static void ego_free(struct ego_core *core)
+{
+    pegoist chip = container_of(core, egoist, core);
+
+    if (chip->split)
+        ego_core_put(&chip->split->core);
+    kfree(chip->packed);
+    kfree(chip->workers);
+    kfree(chip);
+}
+
+void ego_release(pegoist chip)
+{
+    if (chip != NULL) {
+        ego_core_put(&chip->core);
+    } else {
+        pr_err("Failed to alloc mem for egoist\n");
+    }
+}
+
+static int __init ego_false_sharing_init(void)
+{
+    int ret = 0;
+
+    do {
+        chip = kzalloc(sizeof(*chip), GFP_KERNEL);
+        if (!chip) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        ret = ego_core_setup(&chip->core, "ego_false_sharing", ego_free);
+        if (ret)
+            break;
+        mutex_init(&chip->lock);
+        init_completion(&chip->ready);
+        init_completion(&chip->start);
+        chip->duration_ms = 1000;
+        chip->nr_writers = 1;
+        chip->nr_threads = num_online_cpus();
+
+        chip->workers = kcalloc(nr_cpu_ids, sizeof(*chip->workers), GFP_KERNEL);
+        chip->packed = kzalloc(sizeof(*chip->packed), GFP_KERNEL);
+        if (!chip->workers || !chip->packed) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        chip->packed->name = "egoist";
+        chip->packed->debug_on = true;
+        spin_lock_init(&chip->packed->lock);
+
+        /* A second instance of our own, as a real module would look */
+        chip->split = kzalloc(sizeof(*chip->split), GFP_KERNEL);
+        if (!chip->split) {
+            ret = -ENOMEM;
+            break;
+        }
+        ret = ego_core_setup(&chip->split->core, "egoist", fs_split_free);
+        if (ret)
+            break;
+        spin_lock_init(&chip->split->lock);
+
+        debugfs_create_u32("duration_ms", 0644, chip->core.dir, &chip->duration_ms);
+        debugfs_create_u32("nr_writers", 0644, chip->core.dir, &chip->nr_writers);
+        debugfs_create_u32("nr_threads", 0644, chip->core.dir, &chip->nr_threads);
+        debugfs_create_file("run", 0200, chip->core.dir, chip, &fs_run_fops);
+        debugfs_create_file("results", 0444, chip->core.dir, chip, &fs_results_fops);
+
+    } while (0);
+
+    if (ret) {
+        ego_release(chip);
+        return ret;
+    }
+
+    ego_info(chip, "All things goes well, awesome\n");
+    return ret;
+}
+
+static void __exit ego_false_sharing_exit(void)
+{
+    ego_release(chip);
+    pr_info("All things gone\n");
+}
+
+module_init(ego_false_sharing_init);
+module_exit(ego_false_sharing_exit);
+
+MODULE_AUTHOR("Manfred <1259106665@qq.com>");
+MODULE_LICENSE("GPL");
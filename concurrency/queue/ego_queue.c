@@ -0,0 +1,508 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/kthread.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/spinlock.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/smp.h>
+#include <linux/slab.h>
+
+#include "egoist.h"
+#include "ego_queue.h"
+
+#define QUEUE_MAX_RESULTS   128
+#define QUEUE_MAX_BATCH     64
+#define QUEUE_MAX_ORDER     20
+#define QUEUE_TIMEOUT_MS    30000
+
+enum {
+    QUEUE_SPSC = 0,
+    QUEUE_MPSC,
+    QUEUE_KFIFO,
+    QUEUE_NR_QUEUES,
+};
+
+static const char * const queue_name[QUEUE_NR_QUEUES] = {
+    [QUEUE_SPSC] = "spsc",
+    [QUEUE_MPSC] = "mpsc",
+    [QUEUE_KFIFO] = "kfifo",
+};
+
+/* Where the items come from: softirq or hardirq context */
+enum {
+    QUEUE_TASKLET = 0,
+    QUEUE_HRTIMER,
+    QUEUE_NR_PRODUCERS,
+};
+
+static const char * const queue_producer_name[QUEUE_NR_PRODUCERS] = {
+    [QUEUE_TASKLET] = "tasklet",
+    [QUEUE_HRTIMER] = "hrtimer",
+};
+
+/*
+ * Every producer owns a range of values and pushes them in batches, one
+ * batch per tasklet run or per timer expiry. Values are pushed as value + 1
+ * so no item is NULL, the consumer sums them up to see nothing got lost.
+ */
+struct queue_producer {
+    struct tasklet_struct tasklet;
+    struct hrtimer timer;
+    unsigned long next;
+    unsigned long end;
+    u64 full;                   /* pushes cut short by a full queue */
+} ____cacheline_aligned_in_smp;
+
+struct queue_result {
+    const char *queue;
+    const char *producer;
+    unsigned int cpus;
+    u32 batch;
+    u64 items;
+    u64 ns;
+    u64 items_per_sec;
+    u64 full;
+    u64 empty;
+    bool ok;
+};
+
+typedef struct _egoist {
+    struct ego_core core;
+    struct mutex lock;          /* one run at a time, guards results */
+    u32 nr_items;
+    u32 batch;
+    u32 order;
+    u32 period_ns;
+
+    /* Set up for the queue under test only */
+    int queue;
+    int producer;
+    struct ego_spsc *spsc;
+    struct ego_mpsc *mpsc;
+    DECLARE_KFIFO_PTR(fifo, void *);
+    spinlock_t fifo_lock;
+    struct queue_producer *producers;
+    unsigned int nr_producers;
+    struct completion done;
+
+    /* Consumer side, apart from what the producers write */
+    u64 consumed EGO_HOT;
+    u64 sum;
+    u64 empty;
+    u64 t_end;
+    bool stop;
+
+    struct queue_result results[QUEUE_MAX_RESULTS];
+    unsigned int nr_results;
+}egoist, *pegoist;
+pegoist chip;
+
+static __always_inline unsigned int queue_push(pegoist chip, void **items, unsigned int n)
+{
+    switch (chip->queue) {
+    case QUEUE_SPSC:
+        return ego_spsc_push(chip->spsc, items, n);
+    case QUEUE_MPSC:
+        return ego_mpsc_push(chip->mpsc, items, n);
+    default:
+        return kfifo_in_spinlocked(&chip->fifo, items, n, &chip->fifo_lock);
+    }
+}
+
+static __always_inline unsigned int queue_pop(pegoist chip, void **items, unsigned int n)
+{
+    switch (chip->queue) {
+    case QUEUE_SPSC:
+        return ego_spsc_pop(chip->spsc, items, n);
+    case QUEUE_MPSC:
+        return ego_mpsc_pop(chip->mpsc, items, n);
+    default:
+        return kfifo_out_spinlocked(&chip->fifo, items, n, &chip->fifo_lock);
+    }
+}
+
+/* Push one batch, return true while the producer has more to go */
+static bool queue_produce(struct queue_producer *p)
+{
+    void *items[QUEUE_MAX_BATCH];
+    unsigned int n, i, pushed;
+
+    n = min_t(unsigned long, chip->batch, p->end - p->next);
+    for (i = 0; i < n; i++)
+        items[i] = (void *)(p->next + i + 1);
+
+    pushed = queue_push(chip, items, n);
+    if (pushed < n)
+        p->full++;
+    p->next += pushed;
+
+    return p->next < p->end && !READ_ONCE(chip->stop);
+}
+
+static void queue_tasklet(struct tasklet_struct *t)
+{
+    struct queue_producer *p = from_tasklet(p, t, tasklet);
+
+    if (queue_produce(p))
+        tasklet_schedule(&p->tasklet);
+}
+
+static enum hrtimer_restart queue_hrtimer(struct hrtimer *timer)
+{
+    struct queue_producer *p = container_of(timer, struct queue_producer, timer);
+
+    if (!queue_produce(p))
+        return HRTIMER_NORESTART;
+
+    hrtimer_forward_now(timer, ns_to_ktime(chip->period_ns));
+    return HRTIMER_RESTART;
+}
+
+/* Runs on the producer's CPU, so the tasklet and the timer stay there */
+static void queue_kick(void *data)
+{
+    struct queue_producer *p = data;
+
+    if (chip->producer == QUEUE_TASKLET)
+        tasklet_schedule(&p->tasklet);
+    else
+        hrtimer_start(&p->timer, ns_to_ktime(chip->period_ns), HRTIMER_MODE_REL_PINNED_HARD);
+}
+
+static int queue_consumer_thread(void *data)
+{
+    pegoist chip = data;
+    u64 total = chip->nr_items;
+    void *items[QUEUE_MAX_BATCH];
+    unsigned int n, i;
+
+    while (chip->consumed < total && !READ_ONCE(chip->stop)) {
+        n = queue_pop(chip, items, QUEUE_MAX_BATCH);
+        if (!n) {
+            if (!(++chip->empty & 1023))
+                cond_resched();
+            cpu_relax();
+            continue;
+        }
+
+        for (i = 0; i < n; i++)
+            chip->sum += (unsigned long)items[i];
+        chip->consumed += n;
+    }
+    chip->t_end = ktime_get_ns();
+    complete(&chip->done);
+
+    /* Stay around until the runner collected us */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
+
+    return 0;
+}
+
+static int queue_setup(pegoist chip, int queue)
+{
+    int ret = 0;
+
+    chip->queue = queue;
+    switch (queue) {
+    case QUEUE_SPSC:
+        chip->spsc = ego_spsc_alloc(chip->order);
+        if (!chip->spsc)
+            ret = -ENOMEM;
+        break;
+    case QUEUE_MPSC:
+        chip->mpsc = ego_mpsc_alloc(chip->order);
+        if (!chip->mpsc)
+            ret = -ENOMEM;
+        break;
+    default:
+        ret = kfifo_alloc(&chip->fifo, 1U << chip->order, GFP_KERNEL);
+        break;
+    }
+
+    return ret;
+}
+
+static void queue_teardown(pegoist chip)
+{
+    ego_spsc_free(chip->spsc);
+    chip->spsc = NULL;
+    ego_mpsc_free(chip->mpsc);
+    chip->mpsc = NULL;
+    if (chip->queue == QUEUE_KFIFO)
+        kfifo_free(&chip->fifo);
+}
+
+/*
+ * Producers go on the first @cpus online CPUs, the consumer on the last
+ * online CPU, which is left to it whenever there is more than one. An SPSC
+ * queue only ever gets one producer.
+ */
+static int queue_run_one(pegoist chip, int queue, int producer, unsigned int cpus)
+{
+    struct queue_producer *p;
+    struct queue_result *res;
+    struct task_struct *consumer;
+    unsigned int nr = 0, i, ccpu;
+    unsigned long per, start = 0;
+    u64 t0, full = 0, expect;
+    int cpu, ret;
+
+    ret = queue_setup(chip, queue);
+    if (ret)
+        return ret;
+
+    if (queue == QUEUE_SPSC)
+        cpus = 1;
+    chip->producer = producer;
+    chip->consumed = 0;
+    chip->sum = 0;
+    chip->empty = 0;
+    WRITE_ONCE(chip->stop, false);
+    init_completion(&chip->done);
+
+    cpus_read_lock();
+    ccpu = cpumask_last(cpu_online_mask);
+    consumer = kthread_create(queue_consumer_thread, chip, "ego_queue/%u", ccpu);
+    if (IS_ERR(consumer)) {
+        cpus_read_unlock();
+        queue_teardown(chip);
+        return PTR_ERR(consumer);
+    }
+    kthread_bind(consumer, ccpu);
+
+    for_each_online_cpu(cpu) {
+        if (nr >= cpus)
+            break;
+        if (cpu == ccpu && num_online_cpus() > 1)
+            continue;
+        chip->producers[cpu].full = 0;
+        nr++;
+    }
+
+    /* Hand out the values, the last producer takes the remainder */
+    per = chip->nr_items / nr;
+    i = 0;
+    for_each_online_cpu(cpu) {
+        if (i >= nr)
+            break;
+        if (cpu == ccpu && num_online_cpus() > 1)
+            continue;
+        p = &chip->producers[cpu];
+        p->next = start;
+        p->end = ++i == nr ? chip->nr_items : start + per;
+        start = p->end;
+    }
+
+    wake_up_process(consumer);
+    t0 = ktime_get_ns();
+    i = 0;
+    for_each_online_cpu(cpu) {
+        if (i >= nr)
+            break;
+        if (cpu == ccpu && num_online_cpus() > 1)
+            continue;
+        smp_call_function_single(cpu, queue_kick, &chip->producers[cpu], 1);
+        i++;
+    }
+    cpus_read_unlock();
+
+    if (!wait_for_completion_timeout(&chip->done, msecs_to_jiffies(QUEUE_TIMEOUT_MS)))
+        ret = -ETIMEDOUT;
+
+    WRITE_ONCE(chip->stop, true);
+    for_each_possible_cpu(cpu) {
+        p = &chip->producers[cpu];
+        tasklet_kill(&p->tasklet);
+        hrtimer_cancel(&p->timer);
+        full += p->full;
+        p->full = 0;
+    }
+    kthread_stop(consumer);
+
+    if (!ret) {
+        expect = (u64)chip->nr_items * (chip->nr_items + 1) / 2;
+        res = &chip->results[chip->nr_results++ % QUEUE_MAX_RESULTS];
+        res->queue = queue_name[queue];
+        res->producer = queue_producer_name[producer];
+        res->cpus = nr;
+        res->batch = chip->batch;
+        res->items = chip->consumed;
+        res->ns = chip->t_end - t0;
+        res->items_per_sec = res->ns ? div64_u64(res->items * NSEC_PER_SEC, res->ns) : 0;
+        res->full = full;
+        res->empty = chip->empty;
+        res->ok = chip->consumed == chip->nr_items && chip->sum == expect;
+        if (!res->ok)
+            ego_err(chip, "%s/%s lost items, got %llu sum %llu\n", res->queue,
+                    res->producer, chip->consumed, chip->sum);
+        ego_info(chip, "%s/%s cpus:%u done\n", res->queue, res->producer, nr);
+    }
+
+    queue_teardown(chip);
+    return ret;
+}
+
+static int queue_run(pegoist chip, unsigned int cpus)
+{
+    int queue, producer, ret = 0;
+
+    for (producer = 0; producer < QUEUE_NR_PRODUCERS && !ret; producer++)
+        for (queue = 0; queue < QUEUE_NR_QUEUES && !ret; queue++)
+            ret = queue_run_one(chip, queue, producer, cpus);
+
+    return ret;
+}
+
+/* Write a producer CPU count to run every queue, or 0 to sweep 1, 2, 4... CPUs */
+static ssize_t queue_run_write(struct file *filp, const char __user *buf,
+        size_t size, loff_t *pos)
+{
+    pegoist dev = filp->private_data;
+    unsigned int cpus, max = max(num_online_cpus() - 1, 1U);
+    int ret;
+
+    ret = kstrtouint_from_user(buf, size, 0, &cpus);
+    if (ret)
+        return ret;
+
+    mutex_lock(&dev->lock);
+    if (!dev->batch || dev->batch > QUEUE_MAX_BATCH || !dev->nr_items ||
+            !dev->order || dev->order > QUEUE_MAX_ORDER || dev->period_ns < 1000) {
+        ret = -EINVAL;
+    } else if (cpus) {
+        ret = queue_run(dev, min(cpus, max));
+    } else {
+        for (cpus = 1; cpus < max && !ret; cpus <<= 1)
+            ret = queue_run(dev, cpus);
+        if (!ret)
+            ret = queue_run(dev, max);
+    }
+    mutex_unlock(&dev->lock);
+
+    return ret ? ret : size;
+}
+
+static const struct file_operations queue_run_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = queue_run_write,
+};
+
+static int queue_results_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct queue_result *r;
+    unsigned int i, first;
+
+    seq_puts(m, "queue producer cpus batch items ns items_per_sec full empty ok\n");
+
+    mutex_lock(&dev->lock);
+    first = dev->nr_results > QUEUE_MAX_RESULTS ? dev->nr_results - QUEUE_MAX_RESULTS : 0;
+    for (i = first; i < dev->nr_results; i++) {
+        r = &dev->results[i % QUEUE_MAX_RESULTS];
+        seq_printf(m, "%s %s %u %u %llu %llu %llu %llu %llu %d\n", r->queue,
+                r->producer, r->cpus, r->batch, r->items, r->ns,
+                r->items_per_sec, r->full, r->empty, r->ok);
+    }
+    mutex_unlock(&dev->lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(queue_results);
+
+static void ego_free(struct ego_core *core)
+{
+    pegoist chip = container_of(core, egoist, core);
+
+    kfree(chip->producers);
+    kfree(chip);
+}
+
+void ego_release(pegoist chip)
+{
+    if (chip != NULL) {
+        ego_core_put(&chip->core);
+    } else {
+        pr_err("Failed to alloc mem for egoist\n");
+    }
+}
+
+static int __init ego_queue_init(void)
+{
+    struct queue_producer *p;
+    unsigned int i;
+    int ret = 0;
+
+    do {
+        chip = kzalloc(sizeof(*chip), GFP_KERNEL);
+        if (!chip) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        ret = ego_core_setup(&chip->core, "ego_queue", ego_free);
+        if (ret)
+            break;
+        mutex_init(&chip->lock);
+        spin_lock_init(&chip->fifo_lock);
+        chip->nr_items = 1 << 22;
+        chip->batch = 16;
+        chip->order = 10;
+        chip->period_ns = 10000;
+
+        /* Indexed by CPU, so the producer of a CPU always uses its own */
+        chip->producers = kcalloc(nr_cpu_ids, sizeof(*chip->producers), GFP_KERNEL);
+        if (!chip->producers) {
+            ret = -ENOMEM;
+            break;
+        }
+        for (i = 0; i < nr_cpu_ids; i++) {
+            p = &chip->producers[i];
+            tasklet_setup(&p->tasklet, queue_tasklet);
+            hrtimer_init(&p->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED_HARD);
+            p->timer.function = queue_hrtimer;
+        }
+
+        debugfs_create_u32("nr_items", 0644, chip->core.dir, &chip->nr_items);
+        debugfs_create_u32("batch", 0644, chip->core.dir, &chip->batch);
+        debugfs_create_u32("order", 0644, chip->core.dir, &chip->order);
+        debugfs_create_u32("period_ns", 0644, chip->core.dir, &chip->period_ns);
+        debugfs_create_file("run", 0200, chip->core.dir, chip, &queue_run_fops);
+        debugfs_create_file("results", 0444, chip->core.dir, chip, &queue_results_fops);
+
+    } while (0);
+
+    if (ret) {
+        ego_release(chip);
+        return ret;
+    }
+
+    ego_info(chip, "All things goes well, awesome\n");
+    return ret;
+}
+
+static void __exit ego_queue_exit(void)
+{
+    ego_release(chip);
+    pr_info("All things gone\n");
+}
+
+module_init(ego_queue_init);
+module_exit(ego_queue_exit);
+
+MODULE_AUTHOR("Manfred <1259106665@qq.com>");
+MODULE_LICENSE("GPL");
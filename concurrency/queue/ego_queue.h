@@ -0,0 +1,192 @@
+#ifndef _EGO_QUEUE_H
+#define _EGO_QUEUE_H
+
+#include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/compiler.h>
+#include <linux/log2.h>
+#include <linux/minmax.h>
+#include <linux/preempt.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+
+/*
+ * Bounded lock-free queues of pointers, power-of-two sized. Indexes run
+ * freely and wrap, a slot is index & mask. Every push and pop moves a batch
+ * of up to @n items and returns how many it moved, so a full or empty queue
+ * is a short count and never an error.
+ *
+ * The read-only fields share the first cache line, each side's index gets
+ * a line of its own so producers and consumer only meet on the slots.
+ */
+
+/* Single producer, single consumer */
+struct ego_spsc {
+    unsigned int mask;
+    void **slots;
+
+    /* Consumer side, with the last tail it saw */
+    unsigned int head ____cacheline_aligned_in_smp;
+    unsigned int tail_cache;
+
+    /* Producer side, with the last head it saw */
+    unsigned int tail ____cacheline_aligned_in_smp;
+    unsigned int head_cache;
+};
+
+static inline struct ego_spsc *ego_spsc_alloc(unsigned int order)
+{
+    struct ego_spsc *q;
+
+    q = kzalloc(sizeof(*q), GFP_KERNEL);
+    if (!q)
+        return NULL;
+
+    q->mask = (1U << order) - 1;
+    q->slots = kvcalloc(q->mask + 1, sizeof(*q->slots), GFP_KERNEL);
+    if (!q->slots) {
+        kfree(q);
+        return NULL;
+    }
+
+    return q;
+}
+
+static inline void ego_spsc_free(struct ego_spsc *q)
+{
+    if (q) {
+        kvfree(q->slots);
+        kfree(q);
+    }
+}
+
+static inline unsigned int ego_spsc_push(struct ego_spsc *q, void * const *items, unsigned int n)
+{
+    unsigned int tail = q->tail, i, room;
+
+    /* Only go for the consumer's line when the cached head says full */
+    room = q->mask + 1 - (tail - q->head_cache);
+    if (room < n) {
+        q->head_cache = smp_load_acquire(&q->head);
+        room = q->mask + 1 - (tail - q->head_cache);
+    }
+
+    n = min(n, room);
+    for (i = 0; i < n; i++)
+        q->slots[(tail + i) & q->mask] = items[i];
+    smp_store_release(&q->tail, tail + n);
+
+    return n;
+}
+
+static inline unsigned int ego_spsc_pop(struct ego_spsc *q, void **items, unsigned int n)
+{
+    unsigned int head = q->head, i, avail;
+
+    avail = q->tail_cache - head;
+    if (avail < n) {
+        q->tail_cache = smp_load_acquire(&q->tail);
+        avail = q->tail_cache - head;
+    }
+
+    n = min(n, avail);
+    for (i = 0; i < n; i++)
+        items[i] = q->slots[(head + i) & q->mask];
+    smp_store_release(&q->head, head + n);
+
+    return n;
+}
+
+/*
+ * Multiple producers, single consumer. Producers claim a run of slots by
+ * moving tail with cmpxchg and then publish each slot by stamping it with
+ * its index + 1. The consumer stops at the first slot that is not stamped
+ * yet, so a producer stuck between claim and publish holds the consumer up
+ * but never another producer. Push is safe from any context.
+ */
+struct ego_mpsc_slot {
+    unsigned int seq;
+    void *item;
+};
+
+struct ego_mpsc {
+    unsigned int mask;
+    struct ego_mpsc_slot *slots;
+
+    unsigned int head ____cacheline_aligned_in_smp;
+    unsigned int tail ____cacheline_aligned_in_smp;
+};
+
+static inline struct ego_mpsc *ego_mpsc_alloc(unsigned int order)
+{
+    struct ego_mpsc *q;
+    unsigned int i;
+
+    q = kzalloc(sizeof(*q), GFP_KERNEL);
+    if (!q)
+        return NULL;
+
+    q->mask = (1U << order) - 1;
+    q->slots = kvcalloc(q->mask + 1, sizeof(*q->slots), GFP_KERNEL);
+    if (!q->slots) {
+        kfree(q);
+        return NULL;
+    }
+    /* Stamp every slot as one lap old so nothing looks published */
+    for (i = 0; i <= q->mask; i++)
+        q->slots[i].seq = i - q->mask;
+
+    return q;
+}
+
+static inline void ego_mpsc_free(struct ego_mpsc *q)
+{
+    if (q) {
+        kvfree(q->slots);
+        kfree(q);
+    }
+}
+
+static inline unsigned int ego_mpsc_push(struct ego_mpsc *q, void * const *items, unsigned int n)
+{
+    unsigned int tail, room, i;
+    struct ego_mpsc_slot *slot;
+
+    /* Keep the window between claim and publish short */
+    preempt_disable();
+    tail = READ_ONCE(q->tail);
+    do {
+        room = q->mask + 1 - (tail - smp_load_acquire(&q->head));
+        n = min(n, room);
+        if (!n)
+            goto out;
+    } while (!try_cmpxchg(&q->tail, &tail, tail + n));
+
+    for (i = 0; i < n; i++) {
+        slot = &q->slots[(tail + i) & q->mask];
+        slot->item = items[i];
+        smp_store_release(&slot->seq, tail + i + 1);
+    }
+out:
+    preempt_enable();
+    return n;
+}
+
+static inline unsigned int ego_mpsc_pop(struct ego_mpsc *q, void **items, unsigned int n)
+{
+    unsigned int head = q->head, i;
+    struct ego_mpsc_slot *slot;
+
+    for (i = 0; i < n; i++) {
+        slot = &q->slots[(head + i) & q->mask];
+        if (smp_load_acquire(&slot->seq) != head + i + 1)
+            break;
+        items[i] = slot->item;
+    }
+    if (i)
+        smp_store_release(&q->head, head + i);
+
+    return i;
+}
+
+#endif /* _EGO_QUEUE_H */
@@ -5,41 +5,123 @@
 #include <linux/fs.h>
 #include <linux/semaphore.h>
 #include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/rtmutex.h>
+#include <linux/rwsem.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/cpumask.h>
+#include <linux/completion.h>
+#include <linux/random.h>
 
-static bool debug_option = true;    /* hard-code control */
+#include "egoist.h"
 
-#define ego_err(chip, fmt, ...)     \
-    pr_err("%s: %s " fmt, chip->name,   \
-        __func__, ##__VA__ARGS__)
+#define LOCK_MAX_RESULTS    128
+#define LOCK_MAX_NS         100000
 
-#define ego_info(chip, fmt, ...)    \
-    do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_info("%s: %s " fmt, chip->name, \
-                __func__, ##__VA_ARGS__);       \
-        else                                    \
-            ;   \
-    } while(0)
+enum {
+    LOCK_SEMAPHORE = 0,
+    LOCK_MUTEX,
+    LOCK_RT_MUTEX,
+    LOCK_RWSEM,
+    LOCK_NR_LOCKS,
+};
+
+static const char * const lock_name[LOCK_NR_LOCKS] = {
+    [LOCK_SEMAPHORE] = "semaphore",
+    [LOCK_MUTEX] = "mutex",
+    [LOCK_RT_MUTEX] = "rt_mutex",
+    [LOCK_RWSEM] = "rwsem",
+};
+
+/*
+ * A handoff is an acquisition that had to wait for somebody's release: the
+ * lock was released after we asked for it. Its latency runs from that
+ * release to our return from the lock call.
+ */
+struct lock_worker {
+    struct task_struct *task;
+    u64 ops;
+    u64 wait_ns;
+    u64 handoffs;
+    u64 handoff_ns;
+    u64 handoff_max;
+} ____cacheline_aligned_in_smp;
+
+struct lock_result {
+    const char *name;
+    unsigned int threads;
+    u32 cs_ns;
+    u32 read_pct;
+    u64 ops;
+    u64 kops;                   /* thousand critical sections per second */
+    u64 wait_avg_ns;
+    u64 handoffs;
+    u64 handoff_avg_ns;
+    u64 handoff_max_ns;
+};
 
 typedef struct _egoist {
-    char *name;
+    struct ego_core core;
     struct semaphore sem;
     struct delayed_work sem_work;
-    bool debug_on;
+    struct ego_stat *stat_downs;
+    struct ego_stat *stat_wait;
+    struct ego_stat *stat_handoff;
+
+    /* Lock comparison, one run at a time */
+    struct mutex run_lock;      /* guards results */
+    u32 cs_ns;
+    u32 think_ns;
+    u32 read_pct;
+    u32 duration_ms;
+    int lock;
+    struct lock_worker *workers;
+    atomic_t arriving;          /* workers not at the start line yet */
+    struct completion ready;
+    struct completion start;
+    bool stop;
+    struct lock_result results[LOCK_MAX_RESULTS];
+    unsigned int nr_results;
+
+    /* The locks under test and what they protect */
+    struct semaphore bench_sem EGO_HOT;
+    struct mutex bench_mutex EGO_HOT;
+    struct rt_mutex bench_rt_mutex EGO_HOT;
+    struct rw_semaphore bench_rwsem EGO_HOT;
+    u64 released_ns EGO_HOT;
+    unsigned long share_data;
 }egoist, *pegoist;
 pegoist chip;
 
+static void ego_free(struct ego_core *core)
+{
+    pegoist chip = container_of(core, egoist, core);
+
+    kfree(chip->workers);
+    kfree(chip);
+}
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        up(&chip->sem);
-        cancel_delayed_work(&chip->sem_work);
-        kfree(chip);
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
 }
 
+static void ego_sem_stop(void *data)
+{
+    pegoist chip = data;
+
+    cancel_delayed_work_sync(&chip->sem_work);
+}
+
 static void sem_work_handle(struct work_struct *work)
 {
     pegoist dev = container_of(work, egoist, sem_work.work);
@@ -48,34 +130,311 @@ static void sem_work_handle(struct work_struct *work)
     up(&dev->sem);
 }
 
+/* Returns true when the lock was taken for reading */
+static __always_inline bool lock_acquire(pegoist chip)
+{
+    switch (chip->lock) {
+    case LOCK_SEMAPHORE:
+        down(&chip->bench_sem);
+        break;
+    case LOCK_MUTEX:
+        mutex_lock(&chip->bench_mutex);
+        break;
+    case LOCK_RT_MUTEX:
+        rt_mutex_lock(&chip->bench_rt_mutex);
+        break;
+    default:
+        if (chip->read_pct && get_random_u32_below(100) < chip->read_pct) {
+            down_read(&chip->bench_rwsem);
+            return true;
+        }
+        down_write(&chip->bench_rwsem);
+        break;
+    }
+
+    return false;
+}
+
+static __always_inline void lock_release(pegoist chip, bool read)
+{
+    switch (chip->lock) {
+    case LOCK_SEMAPHORE:
+        up(&chip->bench_sem);
+        break;
+    case LOCK_MUTEX:
+        mutex_unlock(&chip->bench_mutex);
+        break;
+    case LOCK_RT_MUTEX:
+        rt_mutex_unlock(&chip->bench_rt_mutex);
+        break;
+    default:
+        if (read)
+            up_read(&chip->bench_rwsem);
+        else
+            up_write(&chip->bench_rwsem);
+        break;
+    }
+}
+
+static int lock_worker_thread(void *data)
+{
+    struct lock_worker *w = data;
+    u64 t_req, t_acq, rel;
+    bool read;
+
+    /* The last one in tells the runner, then all sleep until the start */
+    if (atomic_dec_and_test(&chip->arriving))
+        complete(&chip->ready);
+    wait_for_completion(&chip->start);
+
+    while (!READ_ONCE(chip->stop)) {
+        t_req = ktime_get_ns();
+        read = lock_acquire(chip);
+        t_acq = ktime_get_ns();
+
+        w->wait_ns += t_acq - t_req;
+        rel = READ_ONCE(chip->released_ns);
+        if (rel > t_req) {
+            w->handoffs++;
+            w->handoff_ns += t_acq - rel;
+            w->handoff_max = max(w->handoff_max, t_acq - rel);
+            ego_hist_record(chip->stat_handoff, t_acq - rel);
+        }
+
+        /* Readers share the section, only writers touch the data */
+        if (!read)
+            chip->share_data++;
+        if (chip->cs_ns)
+            ndelay(chip->cs_ns);
+        if (!read)
+            WRITE_ONCE(chip->released_ns, ktime_get_ns());
+        lock_release(chip, read);
+
+        if (chip->think_ns)
+            ndelay(chip->think_ns);
+        if (!(++w->ops & 255))
+            cond_resched();
+    }
+
+    /* Stay around until the runner collected us */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
+
+    return 0;
+}
+
+static int lock_run_one(pegoist chip, int lock, unsigned int threads)
+{
+    struct lock_result r;
+    struct lock_worker *w;
+    unsigned int nr = 0, i;
+    u64 wait_ns = 0, handoff_ns = 0, t0, ns;
+    int cpu, ret = 0;
+
+    chip->lock = lock;
+    chip->released_ns = 0;
+    reinit_completion(&chip->ready);
+    reinit_completion(&chip->start);
+    WRITE_ONCE(chip->stop, false);
+    memset(chip->workers, 0, sizeof(*chip->workers) * nr_cpu_ids);
+
+    cpus_read_lock();
+    for_each_online_cpu(cpu) {
+        if (nr >= threads)
+            break;
+
+        w = &chip->workers[nr];
+        w->task = kthread_create(lock_worker_thread, w, "ego_lock/%d", cpu);
+        if (IS_ERR(w->task)) {
+            ret = PTR_ERR(w->task);
+            w->task = NULL;
+            break;
+        }
+        kthread_bind(w->task, cpu);
+        nr++;
+    }
+    cpus_read_unlock();
+
+    /* Not woken yet, so nobody can count down before we set this */
+    atomic_set(&chip->arriving, nr);
+    for (i = 0; i < nr; i++)
+        wake_up_process(chip->workers[i].task);
+
+    t0 = ktime_get_ns();
+    if (!ret) {
+        if (nr)
+            wait_for_completion(&chip->ready);
+        t0 = ktime_get_ns();
+        complete_all(&chip->start);
+        msleep(chip->duration_ms);
+    }
+    complete_all(&chip->start);
+    WRITE_ONCE(chip->stop, true);
+    ns = ktime_get_ns() - t0;
+
+    memset(&r, 0, sizeof(r));
+    for (i = 0; i < nr; i++) {
+        w = &chip->workers[i];
+        kthread_stop(w->task);
+        r.ops += w->ops;
+        r.handoffs += w->handoffs;
+        r.handoff_max_ns = max(r.handoff_max_ns, w->handoff_max);
+        wait_ns += w->wait_ns;
+        handoff_ns += w->handoff_ns;
+    }
+
+    if (!ret && r.ops) {
+        r.name = lock_name[lock];
+        r.threads = nr;
+        r.cs_ns = chip->cs_ns;
+        r.read_pct = lock == LOCK_RWSEM ? chip->read_pct : 0;
+        r.kops = div64_u64(r.ops * USEC_PER_SEC, ns);
+        r.wait_avg_ns = div64_u64(wait_ns, r.ops);
+        r.handoff_avg_ns = r.handoffs ? div64_u64(handoff_ns, r.handoffs) : 0;
+        chip->results[chip->nr_results++ % LOCK_MAX_RESULTS] = r;
+        ego_info(chip, "%s threads:%u done\n", r.name, nr);
+    }
+
+    return ret;
+}
+
+static int lock_run(pegoist chip, unsigned int threads)
+{
+    int lock, ret = 0;
+
+    for (lock = 0; lock < LOCK_NR_LOCKS && !ret; lock++)
+        ret = lock_run_one(chip, lock, threads);
+
+    return ret;
+}
+
+/* Write a thread count to run every lock, or 0 to sweep 1, 2, 4... threads */
+static ssize_t lock_run_write(struct file *filp, const char __user *buf,
+        size_t size, loff_t *pos)
+{
+    pegoist dev = filp->private_data;
+    unsigned int threads, online = num_online_cpus();
+    int ret;
+
+    ret = kstrtouint_from_user(buf, size, 0, &threads);
+    if (ret)
+        return ret;
+
+    mutex_lock(&dev->run_lock);
+    if (dev->cs_ns > LOCK_MAX_NS || dev->think_ns > LOCK_MAX_NS || dev->read_pct > 100) {
+        ret = -EINVAL;
+    } else if (threads) {
+        ret = lock_run(dev, min(threads, online));
+    } else {
+        for (threads = 1; threads < online && !ret; threads <<= 1)
+            ret = lock_run(dev, threads);
+        if (!ret)
+            ret = lock_run(dev, online);
+    }
+    mutex_unlock(&dev->run_lock);
+
+    return ret ? ret : size;
+}
+
+static const struct file_operations lock_run_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = lock_run_write,
+};
+
+static int lock_results_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct lock_result *r;
+    unsigned int i, first;
+
+    seq_puts(m, "lock threads cs_ns read_pct ops kops_per_sec wait_avg_ns handoffs handoff_avg_ns handoff_max_ns\n");
+
+    mutex_lock(&dev->run_lock);
+    first = dev->nr_results > LOCK_MAX_RESULTS ? dev->nr_results - LOCK_MAX_RESULTS : 0;
+    for (i = first; i < dev->nr_results; i++) {
+        r = &dev->results[i % LOCK_MAX_RESULTS];
+        seq_printf(m, "%s %u %u %u %llu %llu %llu %llu %llu %llu\n", r->name,
+                r->threads, r->cs_ns, r->read_pct, r->ops, r->kops, r->wait_avg_ns,
+                r->handoffs, r->handoff_avg_ns, r->handoff_max_ns);
+    }
+    mutex_unlock(&dev->run_lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lock_results);
+
 static int __init ego_semaphore_init(void)
 {
     int ret = 0;
+    u64 t0;
 
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
 
-        chip->name = "egoist";
-        chip->debug_on = true;
+        ret = ego_core_setup(&chip->core, "egoist", ego_free);
+        if (ret)
+            break;
+        chip->stat_downs = ego_counter_create(chip->core.stats, "downs");
+        chip->stat_wait = ego_hist_create(chip->core.stats, "down_wait_ns");
         sema_init(&chip->sem, 1);
         INIT_DELAYED_WORK(&chip->sem_work, sem_work_handle);
+        ret = ego_core_add_action(&chip->core, ego_sem_stop, chip);
+        if (ret)
+            break;
 
-    } while (0);
+        chip->stat_handoff = ego_hist_create(chip->core.stats, "handoff_ns");
+        mutex_init(&chip->run_lock);
+        init_completion(&chip->ready);
+        init_completion(&chip->start);
+        sema_init(&chip->bench_sem, 1);
+        mutex_init(&chip->bench_mutex);
+        rt_mutex_init(&chip->bench_rt_mutex);
+        init_rwsem(&chip->bench_rwsem);
+        chip->cs_ns = 1000;
+        chip->think_ns = 1000;
+        chip->duration_ms = 1000;
+        chip->workers = kcalloc(nr_cpu_ids, sizeof(*chip->workers), GFP_KERNEL);
+        if (!chip->workers) {
+            ret = -ENOMEM;
+            break;
+        }
 
-    ego_info(chip, "I'm the headmos one\n");
-    if (down_interruptible(&chip->sem)) {
-        ret = EINTR;
-    }
-    schedule_delayed_work(&chip->sem_work, 5 * HZ);
-    if (down_interruptible(&chip->sem)) {
-        ret = EINTR;
-    }
-    ego_info(chip, "The END\n");
-    up(&chip->sem);
+        debugfs_create_u32("cs_ns", 0644, chip->core.dir, &chip->cs_ns);
+        debugfs_create_u32("think_ns", 0644, chip->core.dir, &chip->think_ns);
+        debugfs_create_u32("read_pct", 0644, chip->core.dir, &chip->read_pct);
+        debugfs_create_u32("duration_ms", 0644, chip->core.dir, &chip->duration_ms);
+        debugfs_create_file("run", 0200, chip->core.dir, chip, &lock_run_fops);
+        debugfs_create_file("results", 0444, chip->core.dir, chip, &lock_results_fops);
+
+        ego_info(chip, "I'm the headmos one\n");
+        t0 = ktime_get_ns();
+        if (down_interruptible(&chip->sem)) {
+            ret = -EINTR;
+            break;
+        }
+        ego_counter_inc(chip->stat_downs);
+        ego_hist_record(chip->stat_wait, ktime_get_ns() - t0);
+        schedule_delayed_work(&chip->sem_work, 5 * HZ);
+        t0 = ktime_get_ns();
+        if (down_interruptible(&chip->sem)) {
+            ret = -EINTR;
+            break;
+        }
+        ego_counter_inc(chip->stat_downs);
+        ego_hist_record(chip->stat_wait, ktime_get_ns() - t0);
+        ego_info(chip, "The END\n");
+        up(&chip->sem);
+
+    } while (0);
 
     if (ret) {
         ego_release(chip);
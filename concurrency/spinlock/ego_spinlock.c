@@ -5,69 +5,154 @@
 #include <linux/fs.h>
 #include <linux/interrupt.h>
 #include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/topology.h>
 
-static bool debug_option = true;    /* hard-code control */
+#include "egoist.h"
+#include "ego_stats.h"
+#include "ego_trace.h"
+#include "ego_cpu.h"
 
-#define ego_err(chip, fmt, ...)     \
-    pr_err("%s: %s " fmt, chip->name,   \
-        __func__, ##__VA__ARGS__)
+/* Shared by the CPUs of one node and allocated there */
+struct ego_spin_node {
+    spinlock_t lock;
+    unsigned long share_data;
+} ____cacheline_aligned_in_smp;
 
-#define ego_info(chip, fmt, ...)    \
-    do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_info("%s: %s " fmt, chip->name, \
-                __func__, ##__VA_ARGS__);       \
-        else                                    \
-            ;   \
-    } while(0)
+/* One per online CPU, allocated on its node */
+struct ego_spin_cpu {
+    struct tasklet_struct task;
+    unsigned int cpu;
+    u64 runs;
+};
 
 typedef struct _egoist {
-    char *name;
-    struct tasklet_struct task;
-    spinlock_t lock;
-    unsigned long share_data;
-    bool debug_on;
+    struct ego_core core;
+    struct ego_stat *stat_runs;
+    struct ego_stat *stat_share;
+    struct ego_stat *stat_retired;  /* runs of the tasklets of CPUs gone offline */
+    struct ego_cpuhp hp;
+    struct ego_spin_node **nodes;
+    struct ego_spin_cpu **cpus;
 }egoist, *pegoist;
 pegoist chip;
 
+static void ego_free(struct ego_core *core)
+{
+    pegoist chip = container_of(core, egoist, core);
+    int nid;
+
+    if (chip->nodes) {
+        for_each_node(nid)
+            kfree(chip->nodes[nid]);
+    }
+    kfree(chip->nodes);
+    kfree(chip->cpus);
+    kfree(chip);
+}
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        kfree(chip);
-        tasklet_kill(&chip->task);
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
 }
 
-static void tasklet_handle(unsigned long data)
+static void tasklet_handle(struct tasklet_struct *t)
 {
+    struct ego_spin_cpu *sc = from_tasklet(sc, t, task);
+    struct ego_spin_node *sn = chip->nodes[cpu_to_node(sc->cpu)];
     unsigned long flags;
 
-    ego_info(chip, "Enter, share_data=%lu\n", chip->share_data);
+    trace_ego_tasklet_entry(chip->core.name, sn->share_data);
+    ego_info(chip, "Enter on cpu %u, share_data=%lu\n", sc->cpu, sn->share_data);
+
+    spin_lock_irqsave(&sn->lock, flags);
+    sn->share_data++;
+    spin_unlock_irqrestore(&sn->lock, flags);
+    sc->runs++;
+    ego_count(chip, events);
+    ego_counter_inc(chip->stat_runs);
+    ego_gauge_set(chip->stat_share, sn->share_data);
+    ego_record(chip, EGO_FLIGHT_TASKLET, sc->cpu, sn->share_data, 0);
+
+    ego_info(chip, "Over on cpu %u, share_data=%lu\n", sc->cpu, sn->share_data);
+    trace_ego_tasklet_exit(chip->core.name, sn->share_data);
+}
+
+/* Runs on @cpu, so the tasklet is scheduled there */
+static int ego_spin_cpu_online(struct ego_cpuhp *hp, unsigned int cpu)
+{
+    pegoist chip = container_of(hp, egoist, hp);
+    struct ego_spin_cpu *sc;
+
+    sc = kzalloc_node(sizeof(*sc), GFP_KERNEL, cpu_to_node(cpu));
+    if (!sc)
+        return -ENOMEM;
+
+    sc->cpu = cpu;
+    tasklet_setup(&sc->task, tasklet_handle);
+    chip->cpus[cpu] = sc;
+    tasklet_schedule(&sc->task);
 
-    spin_lock_irqsave(&chip->lock, flags);
-    chip->share_data++;
-    spin_unlock_irqrestore(&chip->lock, flags);
+    return 0;
+}
+
+/* Let a pending run finish here and keep its count */
+static void ego_spin_cpu_offline(struct ego_cpuhp *hp, unsigned int cpu)
+{
+    pegoist chip = container_of(hp, egoist, hp);
+    struct ego_spin_cpu *sc = chip->cpus[cpu];
 
-    ego_info(chip, "Over, share_data=%lu\n", chip->share_data);
+    tasklet_kill(&sc->task);
+    ego_counter_add(chip->stat_retired, sc->runs);
+    chip->cpus[cpu] = NULL;
+    kfree(sc);
 }
 
 static int __init ego_spinlock_init(void)
 {
-    int ret = 0;
+    int nid, ret = 0;
 
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
 
-        chip->name = "egoist";
-        chip->debug_on = true;
-        spin_lock_init(&chip->lock);
-        tasklet_init(&chip->task, tasklet_handle, chip->share_data);        
+        ret = ego_core_setup(&chip->core, "egoist", ego_free);
+        if (ret)
+            break;
+        chip->stat_runs = ego_counter_create(chip->core.stats, "tasklet_runs");
+        chip->stat_share = ego_gauge_create(chip->core.stats, "share_data");
+        chip->stat_retired = ego_counter_create(chip->core.stats, "retired_runs");
+
+        chip->cpus = kcalloc(nr_cpu_ids, sizeof(*chip->cpus), GFP_KERNEL);
+        chip->nodes = kcalloc(nr_node_ids, sizeof(*chip->nodes), GFP_KERNEL);
+        if (!chip->cpus || !chip->nodes) {
+            ret = -ENOMEM;
+            break;
+        }
+        for_each_node(nid) {
+            chip->nodes[nid] = kzalloc_node(sizeof(*chip->nodes[nid]), GFP_KERNEL, nid);
+            if (!chip->nodes[nid]) {
+                ret = -ENOMEM;
+                break;
+            }
+            spin_lock_init(&chip->nodes[nid]->lock);
+        }
+        if (ret)
+            break;
+
+        /* Every online CPU gets its tasklet scheduled right away */
+        chip->hp.cpu_online = ego_spin_cpu_online;
+        chip->hp.cpu_offline = ego_spin_cpu_offline;
+        ret = ego_cpuhp_add(&chip->core, &chip->hp);
+        if (ret)
+            break;
 
     } while (0);
 
@@ -76,8 +161,6 @@ static int __init ego_spinlock_init(void)
         return ret;
     }
 
-    tasklet_schedule(&chip->task);
-    
     ego_info(chip, "All things goes well, awesome\n");
     return ret;
 }
@@ -0,0 +1,112 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/cpuhotplug.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+
+#include "ego_core.h"
+#include "ego_cpu.h"
+#include "ego_internal.h"
+
+/* One dynamic state shared by all instances */
+static enum cpuhp_state ego_cpuhp_state;
+
+static int ego_cpuhp_online(unsigned int cpu, struct hlist_node *node)
+{
+    struct ego_cpuhp *hp = hlist_entry(node, struct ego_cpuhp, node);
+    int nid = cpu_to_node(cpu);
+    int ret;
+
+    if (!hp->node_cpus[nid] && hp->node_online) {
+        ret = hp->node_online(hp, nid);
+        if (ret)
+            return ret;
+    }
+    hp->node_cpus[nid]++;
+
+    if (hp->cpu_online) {
+        ret = hp->cpu_online(hp, cpu);
+        if (ret) {
+            /* The core only rolls back the CPUs that made it */
+            if (!--hp->node_cpus[nid] && hp->node_offline)
+                hp->node_offline(hp, nid);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int ego_cpuhp_offline(unsigned int cpu, struct hlist_node *node)
+{
+    struct ego_cpuhp *hp = hlist_entry(node, struct ego_cpuhp, node);
+    int nid = cpu_to_node(cpu);
+
+    if (hp->cpu_offline)
+        hp->cpu_offline(hp, cpu);
+    if (!--hp->node_cpus[nid] && hp->node_offline)
+        hp->node_offline(hp, nid);
+
+    return 0;
+}
+
+static void ego_cpuhp_remove(void *data)
+{
+    struct ego_cpuhp *hp = data;
+
+    cpuhp_state_remove_instance(ego_cpuhp_state, &hp->node);
+    kfree(hp->node_cpus);
+    hp->node_cpus = NULL;
+}
+
+int ego_cpuhp_add(struct ego_core *core, struct ego_cpuhp *hp)
+{
+    int ret;
+
+    hp->node_cpus = kcalloc(nr_node_ids, sizeof(*hp->node_cpus), GFP_KERNEL);
+    if (!hp->node_cpus)
+        return -ENOMEM;
+
+    ret = cpuhp_state_add_instance(ego_cpuhp_state, &hp->node);
+    if (ret) {
+        kfree(hp->node_cpus);
+        hp->node_cpus = NULL;
+        return ret;
+    }
+
+    return ego_core_add_action(core, ego_cpuhp_remove, hp);
+}
+EXPORT_SYMBOL_GPL(ego_cpuhp_add);
+
+struct task_struct *ego_kthread_run_on_node(int (*fn)(void *data), void *data,
+        int nid, const char *name)
+{
+    struct task_struct *task;
+
+    task = kthread_create_on_node(fn, data, nid, "%s/%d", name, nid);
+    if (IS_ERR(task))
+        return task;
+
+    set_cpus_allowed_ptr(task, cpumask_of_node(nid));
+    wake_up_process(task);
+    return task;
+}
+EXPORT_SYMBOL_GPL(ego_kthread_run_on_node);
+
+int ego_cpuhp_init(void)
+{
+    int ret;
+
+    ret = cpuhp_setup_state_multi(CPUHP_AP_ONLINE_DYN, "ego:online",
+            ego_cpuhp_online, ego_cpuhp_offline);
+    if (ret < 0)
+        return ret;
+
+    ego_cpuhp_state = ret;
+    return 0;
+}
+
+void ego_cpuhp_exit(void)
+{
+    cpuhp_remove_multi_state(ego_cpuhp_state);
+}
@@ -0,0 +1,230 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/sched/clock.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/notifier.h>
+#include <linux/panic_notifier.h>
+#include <linux/kdebug.h>
+
+#include "ego_core.h"
+#include "ego_flight.h"
+#include "ego_internal.h"
+
+#define EGO_FLIGHT_MASK     (EGO_FLIGHT_RECS - 1)
+
+/* One per CPU on its node. pos/end only mean something while dumping */
+struct ego_flight_ring {
+    unsigned int head;          /* next record, runs freely */
+    unsigned int pos;
+    unsigned int end;
+    struct ego_flight_rec recs[EGO_FLIGHT_RECS];
+};
+
+static const char * const ego_flight_event_name[EGO_FLIGHT_NR_EVENTS] = {
+    [EGO_FLIGHT_ERR] = "err",
+    [EGO_FLIGHT_TASKLET] = "tasklet",
+    [EGO_FLIGHT_NOTIFY] = "notify",
+    [EGO_FLIGHT_COMPLETE] = "complete",
+    [EGO_FLIGHT_WAKE] = "wake",
+    [EGO_FLIGHT_HRTIMER] = "hrtimer",
+    [EGO_FLIGHT_STORE] = "store",
+};
+
+static DEFINE_PER_CPU(struct ego_flight_ring *, ego_flight_rings);
+static DEFINE_RAW_SPINLOCK(ego_flight_lock);   /* guards the dump cursors */
+static u32 ego_flight_dump_nr = 64;
+static atomic_t ego_flight_dumped;
+
+void ego_flight_record(struct ego_core *core, enum ego_flight_event event,
+        u64 a0, u64 a1, u64 a2)
+{
+    struct ego_flight_ring *r;
+    struct ego_flight_rec *rec;
+    unsigned long flags;
+
+    local_irq_save(flags);
+    r = __this_cpu_read(ego_flight_rings);
+    if (likely(r)) {
+        rec = &r->recs[r->head & EGO_FLIGHT_MASK];
+        rec->ts_ns = local_clock();
+        rec->a0 = a0;
+        rec->a1 = a1;
+        rec->a2 = a2;
+        rec->event = event;
+        memcpy(rec->who, core->instance, EGO_FLIGHT_WHO - 1);
+        rec->who[EGO_FLIGHT_WHO - 1] = '\0';
+        WRITE_ONCE(r->head, r->head + 1);
+    }
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(ego_flight_record);
+
+/*
+ * Pick the newest @nr records over all CPUs: walk every ring back from its
+ * head, always stepping on the CPU whose previous record is the youngest.
+ * Afterwards [pos, end) of each ring is what was picked.
+ */
+static void ego_flight_select(unsigned int nr)
+{
+    struct ego_flight_ring *r, *best;
+    u64 best_ts = 0, ts;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        r = per_cpu(ego_flight_rings, cpu);
+        if (r)
+            r->pos = r->end = READ_ONCE(r->head);
+    }
+
+    while (nr--) {
+        best = NULL;
+        for_each_possible_cpu(cpu) {
+            r = per_cpu(ego_flight_rings, cpu);
+            if (!r || r->end - r->pos >= min(r->end, EGO_FLIGHT_RECS))
+                continue;
+            ts = r->recs[(r->pos - 1) & EGO_FLIGHT_MASK].ts_ns;
+            if (!best || ts > best_ts) {
+                best = r;
+                best_ts = ts;
+            }
+        }
+        if (!best)
+            break;
+        best->pos--;
+    }
+}
+
+/* Print what ego_flight_select() picked, oldest first, to @m or the console */
+static void ego_flight_emit(struct seq_file *m)
+{
+    struct ego_flight_ring *r, *best;
+    struct ego_flight_rec *rec, *brec = NULL;
+    const char *ev;
+    int cpu, bcpu = 0;
+
+    for (;;) {
+        best = NULL;
+        for_each_possible_cpu(cpu) {
+            r = per_cpu(ego_flight_rings, cpu);
+            if (!r || r->pos == r->end)
+                continue;
+            rec = &r->recs[r->pos & EGO_FLIGHT_MASK];
+            if (!best || rec->ts_ns < brec->ts_ns) {
+                best = r;
+                brec = rec;
+                bcpu = cpu;
+            }
+        }
+        if (!best)
+            break;
+        best->pos++;
+
+        ev = brec->event < EGO_FLIGHT_NR_EVENTS ? ego_flight_event_name[brec->event] : "?";
+        /* Arguments print signed, so an error code reads as one */
+        if (m)
+            seq_printf(m, "%llu %d %s %s %lld %lld %lld\n", brec->ts_ns, bcpu,
+                    brec->who, ev, (s64)brec->a0, (s64)brec->a1, (s64)brec->a2);
+        else
+            pr_emerg("ego_flight: %llu %d %s %s %lld %lld %lld\n", brec->ts_ns,
+                    bcpu, brec->who, ev, (s64)brec->a0, (s64)brec->a1, (s64)brec->a2);
+    }
+}
+
+/*
+ * Once per boot, the first oops is the one that tells. The other CPUs are
+ * stopped on panic, after an oops they may still be recording and a record
+ * being written can come out torn. Never wait for the lock here.
+ */
+static void ego_flight_dump(const char *why)
+{
+    bool locked;
+
+    if (atomic_xchg(&ego_flight_dumped, 1))
+        return;
+
+    locked = raw_spin_trylock(&ego_flight_lock);
+    pr_emerg("ego_flight: last %u records on %s\n", ego_flight_dump_nr, why);
+    pr_emerg("ego_flight: ts_ns cpu instance event a0 a1 a2\n");
+    ego_flight_select(ego_flight_dump_nr);
+    ego_flight_emit(NULL);
+    if (locked)
+        raw_spin_unlock(&ego_flight_lock);
+}
+
+static int ego_flight_panic(struct notifier_block *nb, unsigned long action, void *data)
+{
+    ego_flight_dump("panic");
+    return NOTIFY_DONE;
+}
+
+static int ego_flight_die(struct notifier_block *nb, unsigned long action, void *data)
+{
+    if (action == DIE_OOPS)
+        ego_flight_dump("oops");
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block ego_flight_panic_nb = {
+    .notifier_call = ego_flight_panic,
+};
+
+static struct notifier_block ego_flight_die_nb = {
+    .notifier_call = ego_flight_die,
+};
+
+/* The same records a crash right now would print */
+static int ego_flight_show(struct seq_file *m, void *v)
+{
+    unsigned long flags;
+
+    seq_puts(m, "ts_ns cpu instance event a0 a1 a2\n");
+    raw_spin_lock_irqsave(&ego_flight_lock, flags);
+    ego_flight_select(READ_ONCE(ego_flight_dump_nr));
+    ego_flight_emit(m);
+    raw_spin_unlock_irqrestore(&ego_flight_lock, flags);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ego_flight);
+
+void ego_flight_debugfs_init(struct dentry *root)
+{
+    debugfs_create_file("flight", 0444, root, NULL, &ego_flight_fops);
+    debugfs_create_u32("flight_dump_nr", 0644, root, &ego_flight_dump_nr);
+}
+
+int ego_flight_init(void)
+{
+    struct ego_flight_ring *r;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        r = kzalloc_node(sizeof(*r), GFP_KERNEL, cpu_to_node(cpu));
+        if (!r) {
+            ego_flight_exit();
+            return -ENOMEM;
+        }
+        per_cpu(ego_flight_rings, cpu) = r;
+    }
+
+    atomic_notifier_chain_register(&panic_notifier_list, &ego_flight_panic_nb);
+    register_die_notifier(&ego_flight_die_nb);
+    return 0;
+}
+
+void ego_flight_exit(void)
+{
+    int cpu;
+
+    unregister_die_notifier(&ego_flight_die_nb);
+    atomic_notifier_chain_unregister(&panic_notifier_list, &ego_flight_panic_nb);
+
+    for_each_possible_cpu(cpu) {
+        kfree(per_cpu(ego_flight_rings, cpu));
+        per_cpu(ego_flight_rings, cpu) = NULL;
+    }
+}
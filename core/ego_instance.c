@@ -0,0 +1,148 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+
+#include "ego_core.h"
+#include "ego_stats.h"
+#include "ego_internal.h"
+
+struct ego_action {
+    struct list_head node;
+    void (*fn)(void *data);
+    void *data;
+};
+
+static LIST_HEAD(ego_instances);
+static DEFINE_MUTEX(ego_instance_lock);    /* guards the instance list and names */
+
+static bool ego_instance_taken(const char *instance)
+{
+    struct ego_core *core;
+
+    list_for_each_entry(core, &ego_instances, node) {
+        if (!strcmp(core->instance, instance))
+            return true;
+    }
+    return false;
+}
+
+int __ego_core_setup(struct ego_core *core, const char *name, const char *modname,
+        void (*release)(struct ego_core *core))
+{
+    int n;
+
+    core->name = name;
+    core->debug_on = true;
+    core->release = release;
+    kref_init(&core->ref);
+    INIT_LIST_HEAD(&core->node);
+    INIT_LIST_HEAD(&core->actions);
+
+    core->counters = alloc_percpu(struct ego_counters);
+    if (!core->counters)
+        return -ENOMEM;
+
+    mutex_lock(&ego_instance_lock);
+    strscpy(core->instance, modname, EGO_INSTANCE_LEN);
+    for (n = 1; ego_instance_taken(core->instance); n++)
+        snprintf(core->instance, EGO_INSTANCE_LEN, "%s.%d", modname, n);
+    list_add_tail(&core->node, &ego_instances);
+    mutex_unlock(&ego_instance_lock);
+
+    /* Both are best effort, like every other debugfs and stats user */
+    core->dir = debugfs_create_dir(core->instance, ego_root);
+    core->stats = ego_stats_group_create(core->instance);
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(__ego_core_setup);
+
+int ego_core_add_action(struct ego_core *core, void (*fn)(void *), void *data)
+{
+    struct ego_action *a;
+
+    a = kmalloc(sizeof(*a), GFP_KERNEL);
+    if (!a) {
+        fn(data);
+        return -ENOMEM;
+    }
+
+    a->fn = fn;
+    a->data = data;
+    list_add(&a->node, &core->actions);
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(ego_core_add_action);
+
+struct ego_core *ego_core_get(struct ego_core *core)
+{
+    kref_get(&core->ref);
+    return core;
+}
+EXPORT_SYMBOL_GPL(ego_core_get);
+
+static void ego_core_free(struct kref *ref)
+{
+    struct ego_core *core = container_of(ref, struct ego_core, ref);
+    struct ego_action *a, *tmp;
+
+    /* No new debugfs users and none left inside, then undo the module */
+    debugfs_remove_recursive(core->dir);
+    core->dir = NULL;
+
+    list_for_each_entry_safe(a, tmp, &core->actions, node) {
+        list_del(&a->node);
+        a->fn(a->data);
+        kfree(a);
+    }
+
+    /* Whatever updated the stats has been stopped by now */
+    ego_stats_group_destroy(core->stats);
+    core->stats = NULL;
+
+    mutex_lock(&ego_instance_lock);
+    list_del_init(&core->node);
+    mutex_unlock(&ego_instance_lock);
+
+    free_percpu(core->counters);
+    core->counters = NULL;
+
+    if (core->release)
+        core->release(core);
+}
+
+void ego_core_put(struct ego_core *core)
+{
+    if (core)
+        kref_put(&core->ref, ego_core_free);
+}
+EXPORT_SYMBOL_GPL(ego_core_put);
+
+static int ego_instances_show(struct seq_file *m, void *v)
+{
+    struct ego_core *core;
+    struct ego_counters sum;
+
+    seq_puts(m, "instance name refs events errors\n");
+
+    mutex_lock(&ego_instance_lock);
+    list_for_each_entry(core, &ego_instances, node) {
+        ego_counters_sum(core, &sum);
+        seq_printf(m, "%s %s %u %llu %llu\n", core->instance, core->name,
+                kref_read(&core->ref), sum.events, sum.errors);
+    }
+    mutex_unlock(&ego_instance_lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ego_instances);
+
+void ego_instance_debugfs_init(struct dentry *root)
+{
+    debugfs_create_file("instances", 0444, root, NULL, &ego_instances_fops);
+}
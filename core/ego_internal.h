@@ -0,0 +1,17 @@
+#ifndef _EGO_INTERNAL_H
+#define _EGO_INTERNAL_H
+
+#include <linux/debugfs.h>
+
+/* Shared between the parts of ego_core.ko, not exported */
+extern struct dentry *ego_root;
+
+void ego_stats_debugfs_init(struct dentry *root);
+void ego_instance_debugfs_init(struct dentry *root);
+int ego_cpuhp_init(void);
+void ego_cpuhp_exit(void);
+int ego_flight_init(void);
+void ego_flight_exit(void);
+void ego_flight_debugfs_init(struct dentry *root);
+
+#endif /* _EGO_INTERNAL_H */
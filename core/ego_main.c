@@ -0,0 +1,45 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+
+#include "ego_internal.h"
+
+struct dentry *ego_root;
+
+static int __init ego_core_init(void)
+{
+    int ret;
+
+    ret = ego_flight_init();
+    if (ret)
+        return ret;
+
+    ret = ego_cpuhp_init();
+    if (ret) {
+        ego_flight_exit();
+        return ret;
+    }
+
+    ego_root = debugfs_create_dir("ego", NULL);
+    ego_stats_debugfs_init(ego_root);
+    ego_instance_debugfs_init(ego_root);
+    ego_flight_debugfs_init(ego_root);
+
+    pr_info("ego core loaded\n");
+    return 0;
+}
+
+static void __exit ego_core_exit(void)
+{
+    debugfs_remove_recursive(ego_root);
+    ego_cpuhp_exit();
+    ego_flight_exit();
+    pr_info("ego core gone\n");
+}
+
+module_init(ego_core_init);
+module_exit(ego_core_exit);
+
+MODULE_AUTHOR("Manfred <1259106665@qq.com>");
+MODULE_LICENSE("GPL");
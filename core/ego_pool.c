@@ -0,0 +1,130 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/irqflags.h>
+
+#include "ego_pool.h"
+
+/*
+ * The name is formatted from @fmt and owned by the pool. It names the cache
+ * too, so a second live pool of the same name would collide with it in
+ * /proc/slabinfo. @cpu_max bounds what each CPU may hoard.
+ */
+struct ego_pool *ego_pool_create(unsigned int size, unsigned int cpu_max, const char *fmt, ...)
+{
+    struct ego_pool *pool;
+    va_list args;
+
+    pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+    if (!pool)
+        return NULL;
+
+    va_start(args, fmt);
+    pool->name = kvasprintf(GFP_KERNEL, fmt, args);
+    va_end(args);
+    pool->size = max_t(unsigned int, size, sizeof(void *));
+    pool->cpu_max = cpu_max;
+    pool->pcpu = alloc_percpu(struct ego_pool_pcpu);
+    if (pool->name)
+        pool->cache = kmem_cache_create(pool->name, pool->size, 0,
+                SLAB_HWCACHE_ALIGN, NULL);
+    if (!pool->pcpu || !pool->cache) {
+        kmem_cache_destroy(pool->cache);
+        free_percpu(pool->pcpu);
+        kfree(pool->name);
+        kfree(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+EXPORT_SYMBOL_GPL(ego_pool_create);
+
+/* Every object must have been freed back, the slab complains otherwise */
+void ego_pool_destroy(struct ego_pool *pool)
+{
+    struct ego_pool_pcpu *pc;
+    void *obj;
+    int cpu;
+
+    if (!pool)
+        return;
+
+    for_each_possible_cpu(cpu) {
+        pc = per_cpu_ptr(pool->pcpu, cpu);
+        while ((obj = pc->free)) {
+            pc->free = *(void **)obj;
+            kmem_cache_free(pool->cache, obj);
+        }
+    }
+    kmem_cache_destroy(pool->cache);
+    free_percpu(pool->pcpu);
+    kfree(pool->name);
+    kfree(pool);
+}
+EXPORT_SYMBOL_GPL(ego_pool_destroy);
+
+void *ego_pool_alloc(struct ego_pool *pool, gfp_t gfp)
+{
+    struct ego_pool_pcpu *pc;
+    unsigned long flags;
+    void *obj;
+
+    local_irq_save(flags);
+    pc = this_cpu_ptr(pool->pcpu);
+    obj = pc->free;
+    if (obj) {
+        pc->free = *(void **)obj;
+        pc->nr--;
+        pc->hits++;
+    } else {
+        pc->misses++;
+    }
+    local_irq_restore(flags);
+
+    if (!obj)
+        obj = kmem_cache_alloc(pool->cache, gfp);
+    return obj;
+}
+EXPORT_SYMBOL_GPL(ego_pool_alloc);
+
+void ego_pool_free(struct ego_pool *pool, void *obj)
+{
+    struct ego_pool_pcpu *pc;
+    unsigned long flags;
+
+    if (!obj)
+        return;
+
+    local_irq_save(flags);
+    pc = this_cpu_ptr(pool->pcpu);
+    if (pc->nr < pool->cpu_max) {
+        *(void **)obj = pc->free;
+        pc->free = obj;
+        pc->nr++;
+        obj = NULL;
+    } else {
+        pc->spills++;
+    }
+    local_irq_restore(flags);
+
+    if (obj)
+        kmem_cache_free(pool->cache, obj);
+}
+EXPORT_SYMBOL_GPL(ego_pool_free);
+
+/* Top up the local CPU's list so the first @cpu_max allocations are hits */
+void ego_pool_fill(struct ego_pool *pool, gfp_t gfp)
+{
+    unsigned int i;
+    void *obj;
+
+    for (i = 0; i < pool->cpu_max; i++) {
+        obj = kmem_cache_alloc(pool->cache, gfp);
+        if (!obj)
+            break;
+        ego_pool_free(pool, obj);
+    }
+}
+EXPORT_SYMBOL_GPL(ego_pool_fill);
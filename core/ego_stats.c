@@ -0,0 +1,239 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+
+#include "ego_stats.h"
+#include "ego_internal.h"
+
+static LIST_HEAD(ego_stats_groups);
+static DEFINE_MUTEX(ego_stats_lock);   /* guards the groups and their stats */
+
+struct ego_stats_group *ego_stats_group_create(const char *name)
+{
+    struct ego_stats_group *grp;
+
+    grp = kzalloc(sizeof(*grp), GFP_KERNEL);
+    if (!grp)
+        return NULL;
+
+    grp->name = name;
+    INIT_LIST_HEAD(&grp->stats);
+
+    mutex_lock(&ego_stats_lock);
+    list_add_tail(&grp->node, &ego_stats_groups);
+    mutex_unlock(&ego_stats_lock);
+
+    return grp;
+}
+EXPORT_SYMBOL_GPL(ego_stats_group_create);
+
+static void ego_stat_free(struct ego_stat *s)
+{
+    switch (s->type) {
+    case EGO_STAT_COUNTER:
+        free_percpu(s->counter);
+        break;
+    case EGO_STAT_GAUGE:
+        free_percpu(s->gauge);
+        break;
+    case EGO_STAT_HIST:
+        free_percpu(s->hist);
+        break;
+    }
+    kfree(s);
+}
+
+void ego_stats_group_destroy(struct ego_stats_group *grp)
+{
+    struct ego_stat *s, *tmp;
+
+    if (!grp)
+        return;
+
+    mutex_lock(&ego_stats_lock);
+    list_del(&grp->node);
+    mutex_unlock(&ego_stats_lock);
+
+    list_for_each_entry_safe(s, tmp, &grp->stats, node)
+        ego_stat_free(s);
+    kfree(grp);
+}
+EXPORT_SYMBOL_GPL(ego_stats_group_destroy);
+
+static struct ego_stat *ego_stat_create(struct ego_stats_group *grp,
+        const char *name, enum ego_stat_type type)
+{
+    struct ego_stat *s;
+    int cpu;
+
+    if (!grp)
+        return NULL;
+
+    s = kzalloc(sizeof(*s), GFP_KERNEL);
+    if (!s)
+        return NULL;
+
+    s->name = name;
+    s->type = type;
+    switch (type) {
+    case EGO_STAT_COUNTER:
+        s->counter = alloc_percpu(u64);
+        break;
+    case EGO_STAT_GAUGE:
+        s->gauge = alloc_percpu(struct ego_gauge_pcpu);
+        if (!s->gauge)
+            break;
+        for_each_possible_cpu(cpu) {
+            seqcount_init(&per_cpu_ptr(s->gauge, cpu)->seq);
+            per_cpu_ptr(s->gauge, cpu)->min = U64_MAX;
+        }
+        break;
+    case EGO_STAT_HIST:
+        s->hist = alloc_percpu(struct ego_hist_pcpu);
+        if (!s->hist)
+            break;
+        for_each_possible_cpu(cpu)
+            seqcount_init(&per_cpu_ptr(s->hist, cpu)->seq);
+        break;
+    }
+
+    /* All members of the union alias, any of them tells the allocation failed */
+    if (!s->counter) {
+        kfree(s);
+        return NULL;
+    }
+
+    mutex_lock(&ego_stats_lock);
+    list_add_tail(&s->node, &grp->stats);
+    mutex_unlock(&ego_stats_lock);
+
+    return s;
+}
+
+struct ego_stat *ego_counter_create(struct ego_stats_group *grp, const char *name)
+{
+    return ego_stat_create(grp, name, EGO_STAT_COUNTER);
+}
+EXPORT_SYMBOL_GPL(ego_counter_create);
+
+struct ego_stat *ego_gauge_create(struct ego_stats_group *grp, const char *name)
+{
+    return ego_stat_create(grp, name, EGO_STAT_GAUGE);
+}
+EXPORT_SYMBOL_GPL(ego_gauge_create);
+
+struct ego_stat *ego_hist_create(struct ego_stats_group *grp, const char *name)
+{
+    return ego_stat_create(grp, name, EGO_STAT_HIST);
+}
+EXPORT_SYMBOL_GPL(ego_hist_create);
+
+/* One CPU's share of a histogram, count, sum and buckets from one update */
+static void ego_hist_read_cpu(struct ego_hist_pcpu *h, struct ego_hist_pcpu *snap)
+{
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&h->seq);
+        snap->count = h->count;
+        snap->sum = h->sum;
+        memcpy(snap->bucket, h->bucket, sizeof(snap->bucket));
+    } while (read_seqcount_retry(&h->seq, seq));
+}
+
+static void ego_stat_show(struct seq_file *m, struct ego_stats_group *grp,
+        struct ego_stat *s)
+{
+    struct ego_hist_pcpu *snap;
+    struct ego_gauge_pcpu *g;
+    u64 val = 0, lo = U64_MAX, hi = 0, sum = 0, gmin, gmax;
+    u64 bucket[EGO_HIST_BUCKETS] = { 0 };
+    unsigned int seq;
+    int cpu, i;
+
+    seq_printf(m, "%s.%s ", grp->name, s->name);
+    switch (s->type) {
+    case EGO_STAT_COUNTER:
+        for_each_possible_cpu(cpu)
+            val += READ_ONCE(*per_cpu_ptr(s->counter, cpu));
+        seq_printf(m, "counter %llu\n", val);
+        break;
+    case EGO_STAT_GAUGE:
+        for_each_possible_cpu(cpu) {
+            g = per_cpu_ptr(s->gauge, cpu);
+            do {
+                seq = read_seqcount_begin(&g->seq);
+                gmin = g->min;
+                gmax = g->max;
+            } while (read_seqcount_retry(&g->seq, seq));
+            lo = min(lo, gmin);
+            hi = max(hi, gmax);
+        }
+        /* Nothing set yet, report all zeroes rather than U64_MAX */
+        if (lo > hi)
+            lo = 0;
+        seq_printf(m, "gauge %llu %llu %llu\n", READ_ONCE(s->last), lo, hi);
+        break;
+    case EGO_STAT_HIST:
+        /* Too big for the stack next to bucket[], and we may sleep here */
+        snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+        if (!snap) {
+            seq_puts(m, "hist -ENOMEM\n");
+            break;
+        }
+        for_each_possible_cpu(cpu) {
+            ego_hist_read_cpu(per_cpu_ptr(s->hist, cpu), snap);
+            val += snap->count;
+            sum += snap->sum;
+            for (i = 0; i < EGO_HIST_BUCKETS; i++)
+                bucket[i] += snap->bucket[i];
+        }
+        kfree(snap);
+        seq_printf(m, "hist %llu %llu", val, sum);
+        for (i = 0; i < EGO_HIST_BUCKETS; i++) {
+            if (bucket[i])
+                seq_printf(m, " %d:%llu", i, bucket[i]);
+        }
+        seq_putc(m, '\n');
+        break;
+    }
+}
+
+/*
+ * One line per metric, every group of every module:
+ *
+ *   <group>.<name> counter <value>
+ *   <group>.<name> gauge <last> <min> <max>
+ *   <group>.<name> hist <count> <sum> <bucket>:<n> ...
+ *
+ * The whole file is rendered in a single pass at the first read() and then
+ * served from the seq_file buffer. Each CPU's share of a gauge or histogram
+ * is read under its seqcount, so it is never torn, but CPUs are summed one
+ * after another and not at a single instant.
+ */
+static int ego_stats_snapshot_show(struct seq_file *m, void *v)
+{
+    struct ego_stats_group *grp;
+    struct ego_stat *s;
+
+    seq_printf(m, "# ego_stats v1 ktime_ns %llu\n", ktime_get_ns());
+
+    mutex_lock(&ego_stats_lock);
+    list_for_each_entry(grp, &ego_stats_groups, node) {
+        list_for_each_entry(s, &grp->stats, node)
+            ego_stat_show(m, grp, s);
+    }
+    mutex_unlock(&ego_stats_lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ego_stats_snapshot);
+
+void ego_stats_debugfs_init(struct dentry *root)
+{
+    debugfs_create_file("stats", 0444, root, NULL, &ego_stats_snapshot_fops);
+}
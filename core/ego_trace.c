@@ -0,0 +1,15 @@
+#include <linux/module.h>
+
+#define CREATE_TRACE_POINTS
+#include "ego_trace.h"
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_tasklet_entry);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_tasklet_exit);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_notifier_dispatch_start);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_notifier_dispatch_end);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_completion_wait);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_completion_wake);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_completion_complete);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_hrtimer_fire);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_proc_store);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ego_sysfs_store);
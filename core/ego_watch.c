@@ -0,0 +1,128 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+
+#include "ego_watch.h"
+
+struct ego_watch_waiter {
+    struct wait_queue_entry wq;
+    struct ego_watch *w;
+    u64 seen;
+    bool woken;                 /* took a wakeup, under the readers lock */
+};
+
+void ego_watch_init(struct ego_watch *w)
+{
+    atomic64_set(&w->gen, 1);
+    w->dead = false;
+    init_waitqueue_head(&w->readers);
+    init_waitqueue_head(&w->pollers);
+}
+EXPORT_SYMBOL_GPL(ego_watch_init);
+
+/* Call after storing the new value */
+void ego_watch_bump(struct ego_watch *w)
+{
+    atomic64_inc(&w->gen);
+    smp_mb__after_atomic();
+    wake_up_interruptible(&w->readers);
+    wake_up_interruptible_poll(&w->pollers, EPOLLIN | EPOLLRDNORM);
+}
+EXPORT_SYMBOL_GPL(ego_watch_bump);
+
+/* Every reader returns -ENODEV from now on, pollers see EPOLLHUP */
+void ego_watch_kill(struct ego_watch *w)
+{
+    WRITE_ONCE(w->dead, true);
+    smp_mb();
+    wake_up_interruptible_all(&w->readers);
+    wake_up_interruptible_poll(&w->pollers, EPOLLHUP);
+}
+EXPORT_SYMBOL_GPL(ego_watch_kill);
+
+/*
+ * A reader that is already up to date declines the wakeup, which then goes
+ * to the next exclusive waiter instead of being lost on it.
+ */
+static int ego_watch_wake(struct wait_queue_entry *wq, unsigned int mode, int sync, void *key)
+{
+    struct ego_watch_waiter *ww = container_of(wq, struct ego_watch_waiter, wq);
+    int ret;
+
+    if (ego_watch_gen(ww->w) <= ww->seen && !READ_ONCE(ww->w->dead))
+        return 0;
+    /* Only a wakeup that woke us used up the one a bump hands out */
+    ret = autoremove_wake_function(wq, mode, sync, key);
+    if (ret)
+        ww->woken = true;
+    return ret;
+}
+
+/*
+ * Wait until the generation moves past *@seen and store the one found.
+ * Returns 0, -EAGAIN when @nonblock and nothing changed, -ENODEV once the
+ * watch is killed, or -ERESTARTSYS.
+ */
+int ego_watch_wait(struct ego_watch *w, u64 *seen, bool nonblock)
+{
+    struct ego_watch_waiter ww = {
+        .w = w,
+        .seen = *seen,
+    };
+    bool pass = false;
+    int ret = 0;
+
+    if (READ_ONCE(w->dead))
+        return -ENODEV;
+
+    if (ego_watch_gen(w) <= ww.seen) {
+        if (nonblock)
+            return -EAGAIN;
+
+        init_wait_func(&ww.wq, ego_watch_wake);
+        for (;;) {
+            prepare_to_wait_exclusive(&w->readers, &ww.wq, TASK_INTERRUPTIBLE);
+            if (ego_watch_gen(w) > ww.seen)
+                break;
+            if (READ_ONCE(w->dead)) {
+                ret = -ENODEV;
+                break;
+            }
+            if (signal_pending(current)) {
+                ret = -ERESTARTSYS;
+                break;
+            }
+            schedule();
+        }
+        finish_wait(&w->readers, &ww.wq);
+
+        /*
+         * If we took the bump's one wakeup, hand it on, but only when
+         * somebody still sleeps. Those already up to date decline it.
+         */
+        spin_lock_irq(&w->readers.lock);
+        pass = ww.woken && waitqueue_active(&w->readers);
+        spin_unlock_irq(&w->readers.lock);
+    }
+
+    if (!ret)
+        *seen = ego_watch_gen(w);
+
+    if (pass)
+        wake_up_interruptible(&w->readers);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(ego_watch_wait);
+
+__poll_t ego_watch_poll(struct ego_watch *w, struct file *filp, poll_table *pt, u64 seen)
+{
+    poll_wait(filp, &w->pollers, pt);
+
+    if (READ_ONCE(w->dead))
+        return EPOLLHUP;
+    return ego_watch_gen(w) > seen ? EPOLLIN | EPOLLRDNORM : 0;
+}
+EXPORT_SYMBOL_GPL(ego_watch_poll);
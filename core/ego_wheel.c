@@ -0,0 +1,235 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+
+#include "ego_wheel.h"
+
+static void ego_wheel_queue(struct ego_wheel *wh, struct ego_waiter *w)
+{
+    unsigned long expires = w->expires, delta;
+    int level;
+
+    /* Past deadlines go out on the next tick, far ones come back later */
+    if (time_before(expires, wh->clk))
+        expires = wh->clk;
+    delta = expires - wh->clk;
+    if (delta > EGO_WHEEL_MAX) {
+        delta = EGO_WHEEL_MAX;
+        expires = wh->clk + delta;
+    }
+
+    for (level = 0; level < EGO_WHEEL_LEVELS - 1; level++) {
+        if (delta < 1UL << (EGO_WHEEL_BITS * (level + 1)))
+            break;
+    }
+    hlist_add_head(&w->node,
+            &wh->slots[level][(expires >> (EGO_WHEEL_BITS * level)) & EGO_WHEEL_MASK]);
+}
+
+static void ego_wheel_end_locked(struct ego_wheel *wh, struct ego_waiter *w, int status)
+{
+    if (w->queued) {
+        hlist_del(&w->node);
+        w->queued = false;
+        wh->pending--;
+    }
+    w->status = status;
+    w->woken_ns = ktime_get_ns();
+    complete(&w->done);
+}
+
+static void ego_wheel_cascade(struct ego_wheel *wh)
+{
+    struct ego_waiter *w;
+    struct hlist_node *n;
+    struct hlist_head tmp;
+    unsigned int idx;
+    int level;
+
+    for (level = 1; level < EGO_WHEEL_LEVELS; level++) {
+        idx = (wh->clk >> (EGO_WHEEL_BITS * level)) & EGO_WHEEL_MASK;
+        hlist_move_list(&wh->slots[level][idx], &tmp);
+        hlist_for_each_entry_safe(w, n, &tmp, node) {
+            hlist_del(&w->node);
+            ego_wheel_queue(wh, w);
+        }
+        if (idx)
+            break;
+    }
+}
+
+static void ego_wheel_tick(struct timer_list *t)
+{
+    struct ego_wheel *wh = from_timer(wh, t, timer);
+    struct ego_waiter *w;
+    struct hlist_node *n;
+    struct hlist_head tmp;
+
+    spin_lock(&wh->lock);
+    while (wh->pending && time_after_eq(jiffies, wh->clk)) {
+        if (!(wh->clk & EGO_WHEEL_MASK))
+            ego_wheel_cascade(wh);
+
+        hlist_move_list(&wh->slots[0][wh->clk & EGO_WHEEL_MASK], &tmp);
+        hlist_for_each_entry_safe(w, n, &tmp, node) {
+            if (time_after(w->expires, wh->clk)) {
+                hlist_del(&w->node);
+                ego_wheel_queue(wh, w);
+                continue;
+            }
+            ego_wheel_end_locked(wh, w, -ETIMEDOUT);
+            wh->timeouts++;
+        }
+        wh->clk++;
+    }
+    if (wh->pending)
+        mod_timer(&wh->timer, wh->clk);
+    spin_unlock(&wh->lock);
+}
+
+void ego_wheel_init(struct ego_wheel *wh)
+{
+    int level, idx;
+
+    spin_lock_init(&wh->lock);
+    timer_setup(&wh->timer, ego_wheel_tick, 0);
+    wh->clk = jiffies;
+    for (level = 0; level < EGO_WHEEL_LEVELS; level++)
+        for (idx = 0; idx < EGO_WHEEL_SIZE; idx++)
+            INIT_HLIST_HEAD(&wh->slots[level][idx]);
+}
+EXPORT_SYMBOL_GPL(ego_wheel_init);
+
+/*
+ * Put @w on the wheel with a deadline @timeout jiffies out, without
+ * sleeping. Returns -EINPROGRESS once it is queued, or the status it was
+ * given already when it was woken or cancelled before.
+ */
+int ego_wait_queue(struct ego_wheel *wh, struct ego_waiter *w, unsigned long timeout)
+{
+    int ret = -EINPROGRESS;
+
+    spin_lock_bh(&wh->lock);
+    if (w->status == -EINPROGRESS && wh->dead)
+        ego_wheel_end_locked(wh, w, -ECANCELED);
+    if (w->status != -EINPROGRESS) {
+        ret = w->status;
+        goto out;
+    }
+
+    /* An idle wheel has nothing queued, move it up to now */
+    if (!wh->pending)
+        wh->clk = jiffies;
+    w->expires = jiffies + timeout;
+    ego_wheel_queue(wh, w);
+    w->queued = true;
+    wh->pending++;
+    if (!timer_pending(&wh->timer))
+        mod_timer(&wh->timer, wh->clk);
+out:
+    spin_unlock_bh(&wh->lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(ego_wait_queue);
+
+/*
+ * Sleep until @w, queued by ego_wait_queue(), is woken, times out or is
+ * cancelled. Returns 0 when woken, -ETIMEDOUT, -ECANCELED, or
+ * -ERESTARTSYS on a signal.
+ */
+int ego_wait_for(struct ego_wheel *wh, struct ego_waiter *w)
+{
+    if (wait_for_completion_interruptible(&w->done)) {
+        spin_lock_bh(&wh->lock);
+        if (w->status == -EINPROGRESS)
+            ego_wheel_end_locked(wh, w, -ERESTARTSYS);
+        spin_unlock_bh(&wh->lock);
+    }
+
+    return READ_ONCE(w->status);
+}
+EXPORT_SYMBOL_GPL(ego_wait_for);
+
+/* Wait for ego_wait_wake() at most @timeout jiffies, see ego_wait_for() */
+int ego_wait_timeout(struct ego_wheel *wh, struct ego_waiter *w, unsigned long timeout)
+{
+    int ret;
+
+    ret = ego_wait_queue(wh, w, timeout);
+    if (ret != -EINPROGRESS)
+        return ret;
+
+    return ego_wait_for(wh, w);
+}
+EXPORT_SYMBOL_GPL(ego_wait_timeout);
+
+static bool ego_wait_end(struct ego_wheel *wh, struct ego_waiter *w, int status)
+{
+    bool ended = false;
+
+    spin_lock_bh(&wh->lock);
+    if (w->status == -EINPROGRESS) {
+        ego_wheel_end_locked(wh, w, status);
+        if (status)
+            wh->cancels++;
+        else
+            wh->wakes++;
+        ended = true;
+    }
+    spin_unlock_bh(&wh->lock);
+
+    return ended;
+}
+
+/* False when @w already timed out or was cancelled */
+bool ego_wait_wake(struct ego_wheel *wh, struct ego_waiter *w)
+{
+    return ego_wait_end(wh, w, 0);
+}
+EXPORT_SYMBOL_GPL(ego_wait_wake);
+
+bool ego_wait_cancel(struct ego_wheel *wh, struct ego_waiter *w)
+{
+    return ego_wait_end(wh, w, -ECANCELED);
+}
+EXPORT_SYMBOL_GPL(ego_wait_cancel);
+
+/* Send every queued waiter home with -ECANCELED, returns how many */
+unsigned int ego_wheel_cancel_all(struct ego_wheel *wh)
+{
+    struct ego_waiter *w;
+    struct hlist_node *n;
+    unsigned int nr = 0;
+    int level, idx;
+
+    spin_lock_bh(&wh->lock);
+    for (level = 0; level < EGO_WHEEL_LEVELS; level++) {
+        for (idx = 0; idx < EGO_WHEEL_SIZE; idx++) {
+            hlist_for_each_entry_safe(w, n, &wh->slots[level][idx], node) {
+                ego_wheel_end_locked(wh, w, -ECANCELED);
+                nr++;
+            }
+        }
+    }
+    wh->cancels += nr;
+    spin_unlock_bh(&wh->lock);
+
+    return nr;
+}
+EXPORT_SYMBOL_GPL(ego_wheel_cancel_all);
+
+/* No waiter gets in any more, the ones queued are cancelled */
+void ego_wheel_stop(void *data)
+{
+    struct ego_wheel *wh = data;
+
+    spin_lock_bh(&wh->lock);
+    wh->dead = true;
+    spin_unlock_bh(&wh->lock);
+    ego_wheel_cancel_all(wh);
+    timer_shutdown_sync(&wh->timer);
+}
+EXPORT_SYMBOL_GPL(ego_wheel_stop);
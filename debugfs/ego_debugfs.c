@@ -4,28 +4,20 @@
 #include <linux/fs.h>
 #include <linux/debugfs.h>
 #include <linux/workqueue.h>
+#include <linux/uaccess.h>
+#include <linux/poll.h>
 
-static bool debug_option = true;    /* hard-code control */
-
-#define ego_err(chip, fmt, ...)     \
-    pr_err("%s: %s " fmt, chip->name,   \
-        __func__, ##__VA__ARGS__)
-
-#define ego_info(chip, fmt, ...)    \
-    do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_info("%s: %s " fmt, chip->name, \
-                __func__, ##__VA_ARGS__);       \
-        else                                    \
-            ;   \
-    } while(0)
+#include "egoist.h"
+#include "ego_watch.h"
 
 typedef struct _egoist {
-    char *name;
+    struct ego_core core;
     struct dentry *ego_dir;
     u8 test_u8;
+    struct ego_watch watch;     /* bumped on every store to test_u8 */
     struct delayed_work d_work;
-    bool debug_on;
+    struct ego_stat *stat_runs;
+    struct ego_stat *stat_u8;
 }egoist, *pegoist;
 pegoist chip;
 
@@ -33,20 +25,105 @@ static void print_work_handle(struct work_struct *work)
 {
     pegoist dev = container_of(work, egoist, d_work.work);
     ego_info(dev, "Enter, test_u8=%d\n", dev->test_u8);
+    ego_counter_inc(dev->stat_runs);
+    ego_gauge_set(dev->stat_u8, READ_ONCE(dev->test_u8));
     schedule_delayed_work(&dev->d_work, 4 * HZ);
 }
 
+/* What debugfs_create_u8() does, plus telling the watchers */
+static int test_u8_get(void *data, u64 *val)
+{
+    pegoist dev = data;
+
+    *val = READ_ONCE(dev->test_u8);
+    return 0;
+}
+
+static int test_u8_set(void *data, u64 val)
+{
+    pegoist dev = data;
+
+    if (val > U8_MAX)
+        return -EINVAL;
+
+    WRITE_ONCE(dev->test_u8, val);
+    ego_watch_bump(&dev->watch);
+    return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(test_u8_fops, test_u8_get, test_u8_set, "%llu\n");
+
+/*
+ * One "<generation> <test_u8>" line per change, the file position is the
+ * generation seen last. A fresh open returns the current value at once.
+ */
+static ssize_t test_u8_watch_read(struct file *filp, char __user *buf,
+        size_t size, loff_t *pos)
+{
+    pegoist dev = filp->private_data;
+    char val[32];
+    u64 gen = *pos;
+    int ret, len;
+
+    ret = ego_watch_wait(&dev->watch, &gen, filp->f_flags & O_NONBLOCK);
+    if (ret)
+        return ret;
+
+    len = scnprintf(val, sizeof(val), "%llu %u\n", gen, READ_ONCE(dev->test_u8));
+    if (size < len)
+        return -EINVAL;
+    if (copy_to_user(buf, val, len))
+        return -EFAULT;
+
+    *pos = gen;
+    return len;
+}
+
+static __poll_t test_u8_watch_poll(struct file *filp, poll_table *pt)
+{
+    pegoist dev = filp->private_data;
+
+    return ego_watch_poll(&dev->watch, filp, pt, filp->f_pos);
+}
+
+static const struct file_operations test_u8_watch_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = test_u8_watch_read,
+    .llseek = default_llseek,
+    .poll = test_u8_watch_poll,
+};
+
+EGO_DEFINE_RELEASE(ego_free, egoist)
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        cancel_delayed_work_sync(&chip->d_work);
-        debugfs_remove_recursive(chip->ego_dir);
-        kfree(chip);
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
 }
 
+static void ego_debugfs_remove(void *data)
+{
+    pegoist chip = data;
+
+    debugfs_remove_recursive(chip->ego_dir);
+}
+
+/* Runs before the directory goes, removal waits for sleeping readers */
+static void ego_watch_stop(void *data)
+{
+    ego_watch_kill(data);
+}
+
+static void ego_work_stop(void *data)
+{
+    pegoist chip = data;
+
+    cancel_delayed_work_sync(&chip->d_work);
+}
+
 static int __init ego_print_init(void)
 {
     int ret = 0;
@@ -54,23 +131,39 @@ static int __init ego_print_init(void)
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
 
-        chip->name = "egoist";
-        chip->debug_on = true;
-        chip->ego_dir = debugfs_create_dir(chip->name, NULL);
-        debugfs_create_u8("test_u8", 0660, chip->ego_dir, &chip->test_u8);
+        ret = ego_core_setup(&chip->core, "egoist", ego_free);
+        if (ret)
+            break;
+        chip->stat_runs = ego_counter_create(chip->core.stats, "work_runs");
+        chip->stat_u8 = ego_gauge_create(chip->core.stats, "test_u8");
+        /* The subject of this demo, so on the debugfs root rather than core.dir */
+        chip->ego_dir = debugfs_create_dir(chip->core.name, NULL);
+        ret = ego_core_add_action(&chip->core, ego_debugfs_remove, chip);
+        if (ret)
+            break;
+        ego_watch_init(&chip->watch);
+        ret = ego_core_add_action(&chip->core, ego_watch_stop, &chip->watch);
+        if (ret)
+            break;
+        debugfs_create_file_unsafe("test_u8", 0660, chip->ego_dir, chip, &test_u8_fops);
+        debugfs_create_file("test_u8_watch", 0440, chip->ego_dir, chip, &test_u8_watch_fops);
         INIT_DELAYED_WORK(&chip->d_work, &print_work_handle);
+        ret = ego_core_add_action(&chip->core, ego_work_stop, chip);
+        if (ret)
+            break;
 
     } while (0);
 
-    schedule_delayed_work(&chip->d_work, 0 * HZ);
     if (ret) {
         ego_release(chip);
         return ret;
     }
+
+    schedule_delayed_work(&chip->d_work, 0 * HZ);
     
     ego_info(chip, "All things goes well, awesome\n");
     return ret;
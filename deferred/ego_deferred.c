@@ -0,0 +1,568 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/sort.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/cpumask.h>
+#include <linux/completion.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/llist.h>
+
+#include "egoist.h"
+
+#define DEF_MAX_RESULTS     128
+
+/*
+ * The same stream of work items is pushed through every mechanism. Each
+ * item is stamped right before it is dispatched and its handler records how
+ * long it took to start running; the run ends when the last handler did.
+ */
+struct def_item {
+    union {
+        struct work_struct work;
+        struct kthread_work kwork;
+        struct tasklet_struct tasklet;
+        struct llist_node lnode;
+    };
+    u64 stamp;
+    u32 idx;
+    struct def_run *run;
+};
+
+struct def_run {
+    struct def_item *items;
+    u64 *lat;
+    u32 nr_items;
+    atomic_t pending;
+    struct completion start;
+    struct completion done;
+    u64 t_start;
+    u64 t_end;
+
+    /* Whatever the mechanism under test needs */
+    struct workqueue_struct *wq;
+    struct kthread_worker *kworker;
+    struct task_struct *thread;
+    struct llist_head llist;
+};
+
+struct def_mech {
+    const char *name;
+    int (*setup)(struct def_run *run);
+    void (*prep)(struct def_item *item);
+    void (*dispatch)(struct def_run *run, struct def_item *item);
+    void (*teardown)(struct def_run *run);
+};
+
+struct def_producer {
+    struct task_struct *task;
+    const struct def_mech *mech;
+    struct def_run *run;
+    u32 first;
+    u32 nr;
+};
+
+struct def_result {
+    const char *name;
+    unsigned int cpus;
+    u32 items;
+    u64 p50;
+    u64 p90;
+    u64 p99;
+    u64 p999;
+    u64 max;
+    u64 per_sec;
+};
+
+typedef struct _egoist {
+    struct ego_core core;
+    struct mutex lock;          /* one run at a time, guards results */
+    u32 nr_items;
+    u32 interval_ns;
+    struct def_result results[DEF_MAX_RESULTS];
+    unsigned int nr_results;
+}egoist, *pegoist;
+pegoist chip;
+
+static void def_item_done(struct def_item *item)
+{
+    struct def_run *run = item->run;
+    u64 now = ktime_get_ns();
+
+    run->lat[item->idx] = now - item->stamp;
+    if (atomic_dec_and_test(&run->pending)) {
+        run->t_end = now;
+        complete(&run->done);
+    }
+}
+
+/* Workqueues */
+
+static void def_work_fn(struct work_struct *work)
+{
+    def_item_done(container_of(work, struct def_item, work));
+}
+
+static void def_work_prep(struct def_item *item)
+{
+    INIT_WORK(&item->work, def_work_fn);
+}
+
+static void def_work_dispatch(struct def_run *run, struct def_item *item)
+{
+    queue_work(run->wq, &item->work);
+}
+
+static void def_wq_teardown(struct def_run *run)
+{
+    destroy_workqueue(run->wq);
+}
+
+static int def_system_setup(struct def_run *run)
+{
+    run->wq = system_wq;
+    return 0;
+}
+
+static int def_bound_setup(struct def_run *run)
+{
+    run->wq = alloc_workqueue("ego_def_bound", 0, 0);
+    return run->wq ? 0 : -ENOMEM;
+}
+
+static int def_unbound_setup(struct def_run *run)
+{
+    run->wq = alloc_workqueue("ego_def_unbound", WQ_UNBOUND, 0);
+    return run->wq ? 0 : -ENOMEM;
+}
+
+static int def_highpri_setup(struct def_run *run)
+{
+    run->wq = alloc_workqueue("ego_def_highpri", WQ_HIGHPRI, 0);
+    return run->wq ? 0 : -ENOMEM;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+static int def_bh_setup(struct def_run *run)
+{
+    run->wq = system_bh_wq;
+    return 0;
+}
+#endif
+
+/* Tasklets */
+
+static void def_tasklet_fn(struct tasklet_struct *t)
+{
+    struct def_item *item = from_tasklet(item, t, tasklet);
+
+    def_item_done(item);
+}
+
+static void def_tasklet_prep(struct def_item *item)
+{
+    tasklet_setup(&item->tasklet, def_tasklet_fn);
+}
+
+static void def_tasklet_dispatch(struct def_run *run, struct def_item *item)
+{
+    tasklet_schedule(&item->tasklet);
+}
+
+/* tasklet_action() still touches the tasklet after the handler returned */
+static void def_tasklet_teardown(struct def_run *run)
+{
+    u32 i;
+
+    for (i = 0; i < run->nr_items; i++)
+        tasklet_kill(&run->items[i].tasklet);
+}
+
+/* kthread_worker */
+
+static void def_kwork_fn(struct kthread_work *kwork)
+{
+    def_item_done(container_of(kwork, struct def_item, kwork));
+}
+
+static int def_kworker_setup(struct def_run *run)
+{
+    run->kworker = kthread_create_worker(0, "ego_def_kworker");
+    return PTR_ERR_OR_ZERO(run->kworker);
+}
+
+static void def_kworker_prep(struct def_item *item)
+{
+    kthread_init_work(&item->kwork, def_kwork_fn);
+}
+
+static void def_kworker_dispatch(struct def_run *run, struct def_item *item)
+{
+    kthread_queue_work(run->kworker, &item->kwork);
+}
+
+static void def_kworker_teardown(struct def_run *run)
+{
+    kthread_destroy_worker(run->kworker);
+}
+
+/*
+ * Threaded handler: a dedicated kthread woken when its queue goes from
+ * empty to non-empty, the way an IRQ thread is woken by its hard handler.
+ */
+static int def_thread_fn(void *data)
+{
+    struct def_run *run = data;
+    struct llist_node *list;
+    struct def_item *item, *tmp;
+
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (llist_empty(&run->llist) && !kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+
+        list = llist_reverse_order(llist_del_all(&run->llist));
+        llist_for_each_entry_safe(item, tmp, list, lnode)
+            def_item_done(item);
+    }
+
+    return 0;
+}
+
+static int def_thread_setup(struct def_run *run)
+{
+    init_llist_head(&run->llist);
+    run->thread = kthread_run(def_thread_fn, run, "ego_def_thread");
+    return PTR_ERR_OR_ZERO(run->thread);
+}
+
+static void def_thread_prep(struct def_item *item)
+{
+}
+
+static void def_thread_dispatch(struct def_run *run, struct def_item *item)
+{
+    if (llist_add(&item->lnode, &run->llist))
+        wake_up_process(run->thread);
+}
+
+static void def_thread_teardown(struct def_run *run)
+{
+    kthread_stop(run->thread);
+}
+
+static void def_nop_teardown(struct def_run *run)
+{
+}
+
+static const struct def_mech def_mechs[] = {
+    {
+        .name = "system_wq", .setup = def_system_setup, .prep = def_work_prep,
+        .dispatch = def_work_dispatch, .teardown = def_nop_teardown,
+    },
+    {
+        .name = "bound_wq", .setup = def_bound_setup, .prep = def_work_prep,
+        .dispatch = def_work_dispatch, .teardown = def_wq_teardown,
+    },
+    {
+        .name = "unbound_wq", .setup = def_unbound_setup, .prep = def_work_prep,
+        .dispatch = def_work_dispatch, .teardown = def_wq_teardown,
+    },
+    {
+        .name = "highpri_wq", .setup = def_highpri_setup, .prep = def_work_prep,
+        .dispatch = def_work_dispatch, .teardown = def_wq_teardown,
+    },
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+    {
+        .name = "bh_wq", .setup = def_bh_setup, .prep = def_work_prep,
+        .dispatch = def_work_dispatch, .teardown = def_nop_teardown,
+    },
+#endif
+    {
+        .name = "tasklet", .setup = NULL, .prep = def_tasklet_prep,
+        .dispatch = def_tasklet_dispatch, .teardown = def_tasklet_teardown,
+    },
+    {
+        .name = "kthread_worker", .setup = def_kworker_setup, .prep = def_kworker_prep,
+        .dispatch = def_kworker_dispatch, .teardown = def_kworker_teardown,
+    },
+    {
+        .name = "thread", .setup = def_thread_setup, .prep = def_thread_prep,
+        .dispatch = def_thread_dispatch, .teardown = def_thread_teardown,
+    },
+};
+
+static int def_producer_fn(void *data)
+{
+    struct def_producer *p = data;
+    struct def_run *run = p->run;
+    u32 interval = READ_ONCE(chip->interval_ns);
+    struct def_item *item;
+    u32 i;
+
+    wait_for_completion(&run->start);
+    for (i = p->first; i < p->first + p->nr; i++) {
+        item = &run->items[i];
+        item->stamp = ktime_get_ns();
+        p->mech->dispatch(run, item);
+        if (interval)
+            ndelay(interval);
+        if (!(i & 255))
+            cond_resched();
+    }
+
+    /* Stay around until the runner collected us */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
+
+    return 0;
+}
+
+static int def_cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static u64 def_pct(const u64 *sorted, u32 n, u32 permille)
+{
+    return sorted[min_t(u64, div_u64((u64)n * permille, 1000), n - 1)];
+}
+
+static int def_run_mech(pegoist chip, const struct def_mech *mech, unsigned int cpus)
+{
+    struct def_run *run;
+    struct def_producer *prods;
+    struct def_result *res;
+    unsigned int nr = 0, i;
+    u32 per, first = 0;
+    int cpu, ret = 0;
+
+    run = kzalloc(sizeof(*run), GFP_KERNEL);
+    prods = kcalloc(cpus, sizeof(*prods), GFP_KERNEL);
+    if (!run || !prods) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    run->nr_items = max(chip->nr_items, cpus);
+    run->items = kvcalloc(run->nr_items, sizeof(*run->items), GFP_KERNEL);
+    run->lat = kvcalloc(run->nr_items, sizeof(*run->lat), GFP_KERNEL);
+    if (!run->items || !run->lat) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    init_completion(&run->start);
+    init_completion(&run->done);
+    atomic_set(&run->pending, run->nr_items);
+    for (i = 0; i < run->nr_items; i++) {
+        run->items[i].idx = i;
+        run->items[i].run = run;
+        mech->prep(&run->items[i]);
+    }
+
+    if (mech->setup) {
+        ret = mech->setup(run);
+        if (ret)
+            goto out_free;
+    }
+
+    /* One producer per CPU, the items split evenly between them */
+    per = run->nr_items / cpus;
+    cpus_read_lock();
+    for_each_online_cpu(cpu) {
+        if (nr == cpus)
+            break;
+
+        prods[nr].mech = mech;
+        prods[nr].run = run;
+        prods[nr].first = first;
+        prods[nr].nr = nr == cpus - 1 ? run->nr_items - first : per;
+        prods[nr].task = kthread_create(def_producer_fn, &prods[nr], "ego_def/%d", cpu);
+        if (IS_ERR(prods[nr].task)) {
+            ret = PTR_ERR(prods[nr].task);
+            break;
+        }
+        kthread_bind(prods[nr].task, cpu);
+        first += prods[nr].nr;
+        nr++;
+    }
+    cpus_read_unlock();
+
+    /* Items nobody is going to dispatch are done already */
+    if (run->nr_items - first)
+        atomic_sub(run->nr_items - first, &run->pending);
+
+    for (i = 0; i < nr; i++)
+        wake_up_process(prods[i].task);
+
+    run->t_start = ktime_get_ns();
+    complete_all(&run->start);
+    if (first)
+        wait_for_completion(&run->done);
+
+    for (i = 0; i < nr; i++)
+        kthread_stop(prods[i].task);
+    mech->teardown(run);
+
+    if (!ret && first) {
+        sort(run->lat, first, sizeof(u64), def_cmp_u64, NULL);
+        res = &chip->results[chip->nr_results++ % DEF_MAX_RESULTS];
+        res->name = mech->name;
+        res->cpus = nr;
+        res->items = first;
+        res->p50 = def_pct(run->lat, first, 500);
+        res->p90 = def_pct(run->lat, first, 900);
+        res->p99 = def_pct(run->lat, first, 990);
+        res->p999 = def_pct(run->lat, first, 999);
+        res->max = run->lat[first - 1];
+        res->per_sec = div64_u64((u64)first * NSEC_PER_SEC,
+                max_t(u64, run->t_end - run->t_start, 1));
+        ego_info(chip, "%s cpus:%u done\n", mech->name, nr);
+    }
+
+out_free:
+    if (run) {
+        kvfree(run->lat);
+        kvfree(run->items);
+    }
+    kfree(prods);
+    kfree(run);
+    return ret;
+}
+
+static int def_run(pegoist chip, unsigned int cpus)
+{
+    int i, ret = 0;
+
+    for (i = 0; i < ARRAY_SIZE(def_mechs) && !ret; i++)
+        ret = def_run_mech(chip, &def_mechs[i], cpus);
+
+    return ret;
+}
+
+/* Write a CPU count to run every mechanism, or 0 to sweep 1, 2, 4... CPUs */
+static ssize_t def_run_write(struct file *filp, const char __user *buf,
+        size_t size, loff_t *pos)
+{
+    pegoist dev = filp->private_data;
+    unsigned int cpus, online = num_online_cpus();
+    int ret;
+
+    ret = kstrtouint_from_user(buf, size, 0, &cpus);
+    if (ret)
+        return ret;
+
+    mutex_lock(&dev->lock);
+    if (cpus) {
+        ret = def_run(dev, min(cpus, online));
+    } else {
+        for (cpus = 1; cpus < online && !ret; cpus <<= 1)
+            ret = def_run(dev, cpus);
+        if (!ret)
+            ret = def_run(dev, online);
+    }
+    mutex_unlock(&dev->lock);
+
+    return ret ? ret : size;
+}
+
+static const struct file_operations def_run_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = def_run_write,
+};
+
+static int def_results_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct def_result *r;
+    unsigned int i, first;
+
+    seq_puts(m, "mechanism cpus items p50_ns p90_ns p99_ns p99.9_ns max_ns items_per_sec\n");
+
+    mutex_lock(&dev->lock);
+    first = dev->nr_results > DEF_MAX_RESULTS ? dev->nr_results - DEF_MAX_RESULTS : 0;
+    for (i = first; i < dev->nr_results; i++) {
+        r = &dev->results[i % DEF_MAX_RESULTS];
+        seq_printf(m, "%s %u %u %llu %llu %llu %llu %llu %llu\n", r->name, r->cpus,
+                r->items, r->p50, r->p90, r->p99, r->p999, r->max, r->per_sec);
+    }
+    mutex_unlock(&dev->lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(def_results);
+
+EGO_DEFINE_RELEASE(ego_free, egoist)
+
+void ego_release(pegoist chip)
+{
+    if (chip != NULL) {
+        ego_core_put(&chip->core);
+    } else {
+        pr_err("Failed to alloc mem for egoist\n");
+    }
+}
+
+static int __init ego_deferred_init(void)
+{
+    int ret = 0;
+
+    do {
+        chip = kzalloc(sizeof(*chip), GFP_KERNEL);
+        if (!chip) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        ret = ego_core_setup(&chip->core, "ego_deferred", ego_free);
+        if (ret)
+            break;
+        mutex_init(&chip->lock);
+        chip->nr_items = 100000;
+
+        debugfs_create_u32("nr_items", 0644, chip->core.dir, &chip->nr_items);
+        debugfs_create_u32("interval_ns", 0644, chip->core.dir, &chip->interval_ns);
+        debugfs_create_file("run", 0200, chip->core.dir, chip, &def_run_fops);
+        debugfs_create_file("results", 0444, chip->core.dir, chip, &def_results_fops);
+
+    } while (0);
+
+    if (ret) {
+        ego_release(chip);
+        return ret;
+    }
+
+    ego_info(chip, "All things goes well, awesome\n");
+    return ret;
+}
+
+static void __exit ego_deferred_exit(void)
+{
+    ego_release(chip);
+    pr_info("All things gone\n");
+}
+
+module_init(ego_deferred_init);
+module_exit(ego_deferred_exit);
+
+MODULE_AUTHOR("Manfred <1259106665@qq.com>");
+MODULE_LICENSE("GPL");
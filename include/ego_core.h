@@ -0,0 +1,78 @@
+#ifndef _EGO_CORE_H
+#define _EGO_CORE_H
+
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/types.h>
+
+struct dentry;
+struct ego_stats_group;
+
+/*
+ * Per-CPU counters of an ego module. Every CPU bumps its own copy, so the
+ * fast path never pulls a cache line away from another CPU.
+ */
+struct ego_counters {
+    u64 events;
+    u64 errors;
+};
+
+#define EGO_INSTANCE_LEN    32
+
+/*
+ * One instance of an ego module, exported by ego_core.ko. It is written once
+ * during setup and only read afterwards, so embed it first in the egoist and
+ * open the hot mutable state with EGO_HOT.
+ *
+ * Setup registers the instance as <modname>, or <modname>.<n> when that is
+ * taken, and gives it /sys/kernel/debug/ego/<instance> and a stats group of
+ * the same name. Whatever the module sets up afterwards is undone through
+ * actions, last added first run, when the last reference is put. Then the
+ * debugfs directory and the stats are gone and @release frees the egoist.
+ */
+struct ego_core {
+    const char *name;           /* log prefix */
+    bool debug_on;
+    struct ego_counters __percpu *counters;
+    struct dentry *dir;
+    struct ego_stats_group *stats;
+
+    char instance[EGO_INSTANCE_LEN];
+    struct kref ref;
+    struct list_head node;
+    struct list_head actions;
+    void (*release)(struct ego_core *core);
+};
+
+int __ego_core_setup(struct ego_core *core, const char *name, const char *modname,
+        void (*release)(struct ego_core *core));
+
+/*
+ * Never fails halfway: once it returned, success or not, ego_core_put()
+ * takes everything down again and calls @release.
+ */
+#define ego_core_setup(core, name, release) \
+    __ego_core_setup(core, name, KBUILD_MODNAME, release)
+
+/* Runs @fn(@data) right away and returns -ENOMEM if it cannot be recorded */
+int ego_core_add_action(struct ego_core *core, void (*fn)(void *), void *data);
+
+struct ego_core *ego_core_get(struct ego_core *core);
+void ego_core_put(struct ego_core *core);
+
+static inline void ego_counters_sum(struct ego_core *core, struct ego_counters *sum)
+{
+    struct ego_counters *c;
+    int cpu;
+
+    sum->events = 0;
+    sum->errors = 0;
+    for_each_possible_cpu(cpu) {
+        c = per_cpu_ptr(core->counters, cpu);
+        sum->events += READ_ONCE(c->events);
+        sum->errors += READ_ONCE(c->errors);
+    }
+}
+
+#endif /* _EGO_CORE_H */
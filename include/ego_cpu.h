@@ -0,0 +1,38 @@
+#ifndef _EGO_CPU_H
+#define _EGO_CPU_H
+
+#include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/topology.h>
+#include <linux/types.h>
+
+struct ego_core;
+
+/*
+ * CPU hotplug hooks of one instance, exported by ego_core.ko. Every hook
+ * runs on the CPU in question from its hotplug thread, serialized by the
+ * hotplug lock, and any of them may be NULL.
+ *
+ * The node hooks bracket the CPU hooks: node_online runs right before the
+ * first CPU of a node comes up for this instance and node_offline right
+ * after its last one went down, which is where per-node workers belong.
+ * ego_cpuhp_add() brings up every CPU already online and registers an
+ * action that takes them all down again when the instance goes.
+ */
+struct ego_cpuhp {
+    int (*node_online)(struct ego_cpuhp *hp, int nid);
+    int (*cpu_online)(struct ego_cpuhp *hp, unsigned int cpu);
+    void (*cpu_offline)(struct ego_cpuhp *hp, unsigned int cpu);
+    void (*node_offline)(struct ego_cpuhp *hp, int nid);
+
+    struct hlist_node node;
+    unsigned int *node_cpus;    /* CPUs up per node */
+};
+
+int ego_cpuhp_add(struct ego_core *core, struct ego_cpuhp *hp);
+
+/* A kthread allowed on the CPUs of @nid only, with its stack on @nid */
+struct task_struct *ego_kthread_run_on_node(int (*fn)(void *data), void *data,
+        int nid, const char *name);
+
+#endif /* _EGO_CPU_H */
@@ -0,0 +1,44 @@
+#ifndef _EGO_FLIGHT_H
+#define _EGO_FLIGHT_H
+
+#include <linux/types.h>
+
+struct ego_core;
+
+/*
+ * Flight recorder, exported by ego_core.ko. Every CPU keeps the last
+ * EGO_FLIGHT_RECS binary records in a ring of its own, filled with
+ * interrupts off and nothing formatted, so recording costs a few stores.
+ * On an oops or a panic the last records of all CPUs are printed to the
+ * console in time order, where pstore/ramoops picks them up with the rest
+ * of the kernel log. /sys/kernel/debug/ego/flight shows them any time.
+ */
+#define EGO_FLIGHT_ORDER    8
+#define EGO_FLIGHT_RECS     (1U << EGO_FLIGHT_ORDER)
+#define EGO_FLIGHT_WHO      28
+
+enum ego_flight_event {
+    EGO_FLIGHT_ERR = 0,         /* a0: line */
+    EGO_FLIGHT_TASKLET,         /* a0: cpu, a1: share_data */
+    EGO_FLIGHT_NOTIFY,          /* a0: seq, a1: ret, a2: chain_ns */
+    EGO_FLIGHT_COMPLETE,        /* a0: node */
+    EGO_FLIGHT_WAKE,            /* a0: waiter, a1: waited_ns */
+    EGO_FLIGHT_HRTIMER,         /* a0: expires_ns, a1: late_ns */
+    EGO_FLIGHT_STORE,           /* a0: old, a1: val, a2: ret */
+    EGO_FLIGHT_NR_EVENTS,
+};
+
+/* 64 bytes, the instance name is copied since its module may be gone */
+struct ego_flight_rec {
+    u64 ts_ns;
+    u64 a0;
+    u64 a1;
+    u64 a2;
+    u32 event;
+    char who[EGO_FLIGHT_WHO];
+};
+
+void ego_flight_record(struct ego_core *core, enum ego_flight_event event,
+        u64 a0, u64 a1, u64 a2);
+
+#endif /* _EGO_FLIGHT_H */
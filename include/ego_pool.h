@@ -0,0 +1,46 @@
+#ifndef _EGO_POOL_H
+#define _EGO_POOL_H
+
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+
+/*
+ * Fixed-size object pool exported by ego_core.ko: a dedicated kmem_cache
+ * fronted by a small free list on every CPU. Alloc and free only touch the
+ * local list with interrupts off, so they work from any context and never
+ * bounce a cache line between CPUs. The slab is only visited when the local
+ * list runs dry or overflows @cpu_max.
+ *
+ * Objects keep whatever the previous user left in them, except for the first
+ * pointer-sized word which links the free list.
+ *
+ * The pool's name is its cache's name in /proc/slabinfo and has to be unique
+ * among live caches, so build it from the instance, e.g. "%s_events" with
+ * core.instance.
+ */
+
+struct ego_pool_pcpu {
+    void *free;
+    unsigned int nr;
+    u64 hits;                   /* served from the free list */
+    u64 misses;                 /* went to the slab */
+    u64 spills;                 /* freed to the slab, list was full */
+};
+
+struct ego_pool {
+    char *name;
+    struct kmem_cache *cache;
+    unsigned int size;
+    unsigned int cpu_max;
+    struct ego_pool_pcpu __percpu *pcpu;
+};
+
+__printf(3, 4)
+struct ego_pool *ego_pool_create(unsigned int size, unsigned int cpu_max, const char *fmt, ...);
+void ego_pool_destroy(struct ego_pool *pool);
+void *ego_pool_alloc(struct ego_pool *pool, gfp_t gfp);
+void ego_pool_free(struct ego_pool *pool, void *obj);
+void ego_pool_fill(struct ego_pool *pool, gfp_t gfp);
+
+#endif /* _EGO_POOL_H */
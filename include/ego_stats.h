@@ -0,0 +1,114 @@
+#ifndef _EGO_STATS_H
+#define _EGO_STATS_H
+
+#include <linux/percpu.h>
+#include <linux/irqflags.h>
+#include <linux/bitops.h>
+#include <linux/list.h>
+#include <linux/seqlock.h>
+#include <linux/types.h>
+
+/*
+ * Metrics exported by ego_core.ko. Updates only touch the local CPU's copy
+ * and take no lock, so they are fine from any context including hardirq.
+ * Gauges and histograms span several words per CPU; their updates run with
+ * irqs off inside a per-CPU seqcount so a snapshot never sees them torn.
+ * All groups are published together in /sys/kernel/debug/ego/stats.
+ *
+ * Stats are best effort: the create helpers return NULL on failure and the
+ * update helpers ignore a NULL stat, so callers need no error path.
+ */
+
+/* Bucket i counts values whose highest set bit is i - 1, bucket 0 counts 0 */
+#define EGO_HIST_BUCKETS    65
+
+enum ego_stat_type {
+    EGO_STAT_COUNTER = 0,
+    EGO_STAT_GAUGE,
+    EGO_STAT_HIST,
+};
+
+struct ego_gauge_pcpu {
+    seqcount_t seq;
+    u64 min;
+    u64 max;
+};
+
+struct ego_hist_pcpu {
+    seqcount_t seq;
+    u64 count;
+    u64 sum;
+    u64 bucket[EGO_HIST_BUCKETS];
+};
+
+struct ego_stat {
+    struct list_head node;
+    const char *name;
+    enum ego_stat_type type;
+    u64 last;                   /* gauges only, the value set last */
+    union {
+        u64 __percpu *counter;
+        struct ego_gauge_pcpu __percpu *gauge;
+        struct ego_hist_pcpu __percpu *hist;
+    };
+};
+
+struct ego_stats_group {
+    struct list_head node;
+    const char *name;
+    struct list_head stats;
+};
+
+struct ego_stats_group *ego_stats_group_create(const char *name);
+void ego_stats_group_destroy(struct ego_stats_group *grp);
+struct ego_stat *ego_counter_create(struct ego_stats_group *grp, const char *name);
+struct ego_stat *ego_gauge_create(struct ego_stats_group *grp, const char *name);
+struct ego_stat *ego_hist_create(struct ego_stats_group *grp, const char *name);
+
+static inline void ego_counter_add(struct ego_stat *s, u64 v)
+{
+    if (s)
+        this_cpu_add(*s->counter, v);
+}
+
+#define ego_counter_inc(s)  ego_counter_add(s, 1)
+
+static inline void ego_gauge_set(struct ego_stat *s, u64 v)
+{
+    struct ego_gauge_pcpu *g;
+    unsigned long flags;
+
+    if (!s)
+        return;
+
+    WRITE_ONCE(s->last, v);
+    local_irq_save(flags);
+    g = this_cpu_ptr(s->gauge);
+    write_seqcount_begin(&g->seq);
+    if (v < g->min)
+        g->min = v;
+    if (v > g->max)
+        g->max = v;
+    write_seqcount_end(&g->seq);
+    local_irq_restore(flags);
+}
+
+static inline void ego_hist_record(struct ego_stat *s, u64 v)
+{
+    struct ego_hist_pcpu *h;
+    unsigned long flags;
+
+    if (!s)
+        return;
+
+    local_irq_save(flags);
+    h = this_cpu_ptr(s->hist);
+    write_seqcount_begin(&h->seq);
+    h->bucket[fls64(v)]++;
+    h->count++;
+    h->sum += v;
+    write_seqcount_end(&h->seq);
+    local_irq_restore(flags);
+}
+
+#endif /* _EGO_STATS_H */
@@ -0,0 +1,172 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ego
+
+#if !defined(_EGO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _EGO_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/string.h>
+
+/*
+ * Tracepoints of the ego modules, defined in ego_core.ko. A disabled
+ * tracepoint is a patched-out static branch; work done only to feed one
+ * (timestamps and the like) must sit behind trace_<event>_enabled().
+ *
+ * Module names are copied into the event, the module that emitted it may
+ * be gone by the time the buffer is read.
+ */
+#define EGO_TRACE_NAME_LEN  24
+
+DECLARE_EVENT_CLASS(ego_tasklet,
+    TP_PROTO(const char *name, unsigned long share_data),
+    TP_ARGS(name, share_data),
+    TP_STRUCT__entry(
+        __array(char, name, EGO_TRACE_NAME_LEN)
+        __field(unsigned long, share_data)
+    ),
+    TP_fast_assign(
+        strscpy(__entry->name, name, EGO_TRACE_NAME_LEN);
+        __entry->share_data = share_data;
+    ),
+    TP_printk("%s share_data=%lu", __entry->name, __entry->share_data)
+);
+
+DEFINE_EVENT(ego_tasklet, ego_tasklet_entry,
+    TP_PROTO(const char *name, unsigned long share_data),
+    TP_ARGS(name, share_data)
+);
+
+DEFINE_EVENT(ego_tasklet, ego_tasklet_exit,
+    TP_PROTO(const char *name, unsigned long share_data),
+    TP_ARGS(name, share_data)
+);
+
+TRACE_EVENT(ego_notifier_dispatch_start,
+    TP_PROTO(const char *name, unsigned long action),
+    TP_ARGS(name, action),
+    TP_STRUCT__entry(
+        __array(char, name, EGO_TRACE_NAME_LEN)
+        __field(unsigned long, action)
+    ),
+    TP_fast_assign(
+        strscpy(__entry->name, name, EGO_TRACE_NAME_LEN);
+        __entry->action = action;
+    ),
+    TP_printk("%s action=%lu", __entry->name, __entry->action)
+);
+
+TRACE_EVENT(ego_notifier_dispatch_end,
+    TP_PROTO(const char *name, unsigned long action, int ret),
+    TP_ARGS(name, action, ret),
+    TP_STRUCT__entry(
+        __array(char, name, EGO_TRACE_NAME_LEN)
+        __field(unsigned long, action)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        strscpy(__entry->name, name, EGO_TRACE_NAME_LEN);
+        __entry->action = action;
+        __entry->ret = ret;
+    ),
+    TP_printk("%s action=%lu ret=0x%x", __entry->name, __entry->action, __entry->ret)
+);
+
+TRACE_EVENT(ego_completion_wait,
+    TP_PROTO(const char *name, int waiter),
+    TP_ARGS(name, waiter),
+    TP_STRUCT__entry(
+        __array(char, name, EGO_TRACE_NAME_LEN)
+        __field(int, waiter)
+    ),
+    TP_fast_assign(
+        strscpy(__entry->name, name, EGO_TRACE_NAME_LEN);
+        __entry->waiter = waiter;
+    ),
+    TP_printk("%s waiter=%d", __entry->name, __entry->waiter)
+);
+
+TRACE_EVENT(ego_completion_wake,
+    TP_PROTO(const char *name, int waiter, u64 waited_ns),
+    TP_ARGS(name, waiter, waited_ns),
+    TP_STRUCT__entry(
+        __array(char, name, EGO_TRACE_NAME_LEN)
+        __field(int, waiter)
+        __field(u64, waited_ns)
+    ),
+    TP_fast_assign(
+        strscpy(__entry->name, name, EGO_TRACE_NAME_LEN);
+        __entry->waiter = waiter;
+        __entry->waited_ns = waited_ns;
+    ),
+    TP_printk("%s waiter=%d waited_ns=%llu", __entry->name, __entry->waiter,
+        __entry->waited_ns)
+);
+
+TRACE_EVENT(ego_completion_complete,
+    TP_PROTO(const char *name),
+    TP_ARGS(name),
+    TP_STRUCT__entry(
+        __array(char, name, EGO_TRACE_NAME_LEN)
+    ),
+    TP_fast_assign(
+        strscpy(__entry->name, name, EGO_TRACE_NAME_LEN);
+    ),
+    TP_printk("%s", __entry->name)
+);
+
+TRACE_EVENT(ego_hrtimer_fire,
+    TP_PROTO(const char *name, s64 expires_ns, s64 late_ns),
+    TP_ARGS(name, expires_ns, late_ns),
+    TP_STRUCT__entry(
+        __array(char, name, EGO_TRACE_NAME_LEN)
+        __field(s64, expires_ns)
+        __field(s64, late_ns)
+    ),
+    TP_fast_assign(
+        strscpy(__entry->name, name, EGO_TRACE_NAME_LEN);
+        __entry->expires_ns = expires_ns;
+        __entry->late_ns = late_ns;
+    ),
+    TP_printk("%s expires_ns=%lld late_ns=%lld", __entry->name,
+        __entry->expires_ns, __entry->late_ns)
+);
+
+DECLARE_EVENT_CLASS(ego_store,
+    TP_PROTO(const char *name, const char *attr, long old, long val, int ret),
+    TP_ARGS(name, attr, old, val, ret),
+    TP_STRUCT__entry(
+        __array(char, name, EGO_TRACE_NAME_LEN)
+        __array(char, attr, EGO_TRACE_NAME_LEN)
+        __field(long, old)
+        __field(long, val)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        strscpy(__entry->name, name, EGO_TRACE_NAME_LEN);
+        strscpy(__entry->attr, attr, EGO_TRACE_NAME_LEN);
+        __entry->old = old;
+        __entry->val = val;
+        __entry->ret = ret;
+    ),
+    TP_printk("%s %s old=%ld val=%ld ret=%d", __entry->name, __entry->attr,
+        __entry->old, __entry->val, __entry->ret)
+);
+
+DEFINE_EVENT(ego_store, ego_proc_store,
+    TP_PROTO(const char *name, const char *attr, long old, long val, int ret),
+    TP_ARGS(name, attr, old, val, ret)
+);
+
+DEFINE_EVENT(ego_store, ego_sysfs_store,
+    TP_PROTO(const char *name, const char *attr, long old, long val, int ret),
+    TP_ARGS(name, attr, old, val, ret)
+);
+
+#endif /* _EGO_TRACE_H */
+
+/* Found through the -I of include/, see the Makefiles */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ego_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,44 @@
+#ifndef _EGO_WATCH_H
+#define _EGO_WATCH_H
+
+#include <linux/atomic.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/types.h>
+
+/*
+ * A value readers can block on until it changes, exported by ego_core.ko.
+ * The writer stores the value and then calls ego_watch_bump(), which moves
+ * the generation on and wakes one blocked reader. That reader hands the
+ * wakeup on to the next one still behind once it has the new generation,
+ * so a change never wakes the whole herd at once. A reader that did not
+ * sleep, or that nobody is queued behind, wakes no one. Pollers are woken
+ * all.
+ *
+ * Generations start at 1, a reader that has seen nothing passes 0. Kill the
+ * watch before removing the files its readers sleep in, or the removal
+ * waits for them forever.
+ */
+struct ego_watch {
+    atomic64_t gen;
+    bool dead;
+    wait_queue_head_t readers;  /* exclusive */
+    wait_queue_head_t pollers;
+};
+
+void ego_watch_init(struct ego_watch *w);
+void ego_watch_bump(struct ego_watch *w);
+void ego_watch_kill(struct ego_watch *w);
+int ego_watch_wait(struct ego_watch *w, u64 *seen, bool nonblock);
+__poll_t ego_watch_poll(struct ego_watch *w, struct file *filp, poll_table *pt, u64 seen);
+
+/* Read the value after this, it is at least as new as the generation */
+static inline u64 ego_watch_gen(struct ego_watch *w)
+{
+    u64 gen = atomic64_read(&w->gen);
+
+    smp_rmb();
+    return gen;
+}
+
+#endif /* _EGO_WATCH_H */
@@ -0,0 +1,68 @@
+#ifndef _EGO_WHEEL_H
+#define _EGO_WHEEL_H
+
+#include <linux/completion.h>
+#include <linux/jiffies.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/types.h>
+
+/*
+ * A wait service exported by ego_core.ko for many waiters with deadlines
+ * of their own. Instead of a timer per waiter, which is what
+ * wait_for_completion_timeout() arms, all deadlines go into one
+ * hierarchical timer wheel driven by a single timer_list. Level l has 64 slots of 64^l jiffies each, a waiter goes to
+ * the level its distance to the deadline fits in, and higher levels
+ * cascade down whenever the level below wraps. Queueing and waking are
+ * O(1), the timer ticks once per jiffy and only while waiters are queued.
+ */
+#define EGO_WHEEL_BITS      6
+#define EGO_WHEEL_SIZE      (1 << EGO_WHEEL_BITS)
+#define EGO_WHEEL_MASK      (EGO_WHEEL_SIZE - 1)
+#define EGO_WHEEL_LEVELS    4
+#define EGO_WHEEL_MAX       ((1UL << (EGO_WHEEL_BITS * EGO_WHEEL_LEVELS)) - 1)
+
+struct ego_wheel {
+    spinlock_t lock;
+    struct timer_list timer;
+    unsigned long clk;          /* next jiffy to expire */
+    unsigned int pending;
+    bool dead;
+    u64 timeouts;
+    u64 wakes;
+    u64 cancels;
+    struct hlist_head slots[EGO_WHEEL_LEVELS][EGO_WHEEL_SIZE];
+};
+
+/*
+ * Set up with ego_waiter_init() before every wait. It may be woken or
+ * cancelled before it waits, the wait then returns at once, so it must
+ * outlive whoever may still wake it.
+ */
+struct ego_waiter {
+    struct completion done;
+    struct hlist_node node;
+    unsigned long expires;
+    u64 woken_ns;               /* when the wake, timeout or cancel happened */
+    int status;                 /* -EINPROGRESS until decided */
+    bool queued;
+};
+
+static inline void ego_waiter_init(struct ego_waiter *w)
+{
+    init_completion(&w->done);
+    w->status = -EINPROGRESS;
+    w->queued = false;
+}
+
+void ego_wheel_init(struct ego_wheel *wh);
+int ego_wait_queue(struct ego_wheel *wh, struct ego_waiter *w, unsigned long timeout);
+int ego_wait_for(struct ego_wheel *wh, struct ego_waiter *w);
+int ego_wait_timeout(struct ego_wheel *wh, struct ego_waiter *w, unsigned long timeout);
+bool ego_wait_wake(struct ego_wheel *wh, struct ego_waiter *w);
+bool ego_wait_cancel(struct ego_wheel *wh, struct ego_waiter *w);
+unsigned int ego_wheel_cancel_all(struct ego_wheel *wh);
+void ego_wheel_stop(void *data);
+
+#endif /* _EGO_WHEEL_H */
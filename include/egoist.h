@@ -0,0 +1,48 @@
+#ifndef _EGOIST_H
+#define _EGOIST_H
+
+#include <linux/cache.h>
+#include <linux/printk.h>
+#include <linux/slab.h>
+
+#include "ego_core.h"
+#include "ego_stats.h"
+#include "ego_flight.h"
+
+static bool __maybe_unused debug_option = true;    /* hard-code control */
+
+#define EGO_HOT     ____cacheline_aligned_in_smp
+
+#define ego_err(chip, fmt, ...)     \
+    do {                            \
+        ego_record(chip, EGO_FLIGHT_ERR, __LINE__, 0, 0);   \
+        pr_err("%s: %s " fmt, (chip)->core.name,   \
+            __func__, ##__VA_ARGS__);   \
+    } while(0)
+
+#define ego_info(chip, fmt, ...)    \
+    do {                            \
+        if ((chip)->core.debug_on && debug_option)        \
+            pr_info("%s: %s " fmt, (chip)->core.name, \
+                __func__, ##__VA_ARGS__);       \
+        else                                    \
+            ;   \
+    } while(0)
+
+/* Into the flight recorder, see ego_flight.h for the events */
+#define ego_record(chip, event, a0, a1, a2) \
+    ego_flight_record(&(chip)->core, event, a0, a1, a2)
+
+#define ego_count(chip, field)  this_cpu_inc((chip)->core.counters->field)
+
+/*
+ * Every egoist is kzalloc()ed with its ego_core named core, the last
+ * ego_core_put() hands it back here.
+ */
+#define EGO_DEFINE_RELEASE(fn, type)                                    \
+    static void fn(struct ego_core *core)                               \
+    {                                                                   \
+        kfree(container_of(core, type, core));                          \
+    }
+
+#endif /* _EGOIST_H */
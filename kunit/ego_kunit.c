@@ -0,0 +1,773 @@
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/random.h>
+#include <linux/rbtree.h>
+#include <linux/hashtable.h>
+#include <linux/xarray.h>
+
+#include "ego_queue.h"
+#include "ego_notifier.h"
+#include "ego_wheel.h"
+
+/*
+ * Correctness tests and timed micro-benchmarks for the locking, notifier,
+ * timer and ADT paths the modules use. No hardware needed, so the suites
+ * run under kunit.py in UML or QEMU as well as from insmod on a running
+ * kernel. The timer suite drives the wheel ego_core.ko exports.
+ *
+ * A benchmark fails when it is slower than its ceiling times bench_slack.
+ * The ceilings sit well above what a slow UML guest does, they are there
+ * to catch an order of magnitude, not ten percent. bench_slack=0 only
+ * reports the timings.
+ */
+static unsigned int bench_slack = 1;
+module_param(bench_slack, uint, 0644);
+MODULE_PARM_DESC(bench_slack, "Multiplier on the benchmark ceilings, 0 to only report");
+
+#define EGO_BENCH_OPS       100000
+
+static void ego_bench_check(struct kunit *test, const char *what, u64 ns, u64 ops,
+        u64 ceiling_ns)
+{
+    u64 per_op = ops ? div64_u64(ns, ops) : 0;
+
+    kunit_info(test, "%s: %llu ops, %llu ns/op\n", what, ops, per_op);
+    if (bench_slack)
+        KUNIT_EXPECT_LE_MSG(test, per_op, ceiling_ns * bench_slack,
+                "%s regressed", what);
+}
+
+/* Locking: the lock-free queues and the locks they are measured against */
+
+static void ego_spsc_fifo_test(struct kunit *test)
+{
+    struct ego_spsc *q = ego_spsc_alloc(3);
+    void *in[8], *out[8];
+    unsigned long i, lap;
+
+    KUNIT_ASSERT_NOT_NULL(test, q);
+    for (i = 0; i < 8; i++)
+        in[i] = (void *)(i + 1);
+
+    KUNIT_EXPECT_EQ(test, ego_spsc_pop(q, out, 8), 0U);
+
+    /* Several laps, so the free running indexes wrap the slots */
+    for (lap = 0; lap < 5; lap++) {
+        KUNIT_EXPECT_EQ(test, ego_spsc_push(q, in, 5), 5U);
+        /* Only three slots left, a short count and not an error */
+        KUNIT_EXPECT_EQ(test, ego_spsc_push(q, in + 5, 8), 3U);
+        KUNIT_EXPECT_EQ(test, ego_spsc_push(q, in, 1), 0U);
+        KUNIT_EXPECT_EQ(test, ego_spsc_pop(q, out, 8), 8U);
+        for (i = 0; i < 8; i++)
+            KUNIT_EXPECT_PTR_EQ(test, out[i], in[i]);
+    }
+
+    ego_spsc_free(q);
+}
+
+static void ego_mpsc_fifo_test(struct kunit *test)
+{
+    struct ego_mpsc *q = ego_mpsc_alloc(2);
+    void *in[4], *out[4];
+    unsigned long i, lap;
+
+    KUNIT_ASSERT_NOT_NULL(test, q);
+    for (i = 0; i < 4; i++)
+        in[i] = (void *)(i + 1);
+
+    KUNIT_EXPECT_EQ(test, ego_mpsc_pop(q, out, 4), 0U);
+    for (lap = 0; lap < 5; lap++) {
+        KUNIT_EXPECT_EQ(test, ego_mpsc_push(q, in, 3), 3U);
+        KUNIT_EXPECT_EQ(test, ego_mpsc_push(q, in + 3, 4), 1U);
+        KUNIT_EXPECT_EQ(test, ego_mpsc_push(q, in, 1), 0U);
+        KUNIT_EXPECT_EQ(test, ego_mpsc_pop(q, out, 2), 2U);
+        KUNIT_EXPECT_EQ(test, ego_mpsc_pop(q, out + 2, 4), 2U);
+        for (i = 0; i < 4; i++)
+            KUNIT_EXPECT_PTR_EQ(test, out[i], in[i]);
+    }
+
+    ego_mpsc_free(q);
+}
+
+#define MPSC_PRODUCERS      4
+#define MPSC_ITEMS          20000
+
+struct mpsc_producer {
+    struct ego_mpsc *q;
+    unsigned long id;
+    struct completion *done;
+};
+
+static int mpsc_producer_thread(void *data)
+{
+    struct mpsc_producer *p = data;
+    unsigned long seq = 0;
+    void *item;
+
+    /* Item is producer id in the top bits and its sequence below */
+    while (seq < MPSC_ITEMS) {
+        item = (void *)((p->id << 24) | (seq + 1));
+        if (ego_mpsc_push(p->q, &item, 1))
+            seq++;
+        else
+            cond_resched();
+    }
+    complete(p->done);
+
+    return 0;
+}
+
+static void ego_mpsc_producers_test(struct kunit *test)
+{
+    struct mpsc_producer prods[MPSC_PRODUCERS];
+    unsigned long next[MPSC_PRODUCERS] = { 0 }, id, seq, got = 0;
+    struct completion done;
+    struct task_struct *task;
+    struct ego_mpsc *q = ego_mpsc_alloc(8);
+    void *items[32];
+    unsigned int n, i, nr;
+
+    KUNIT_ASSERT_NOT_NULL(test, q);
+    init_completion(&done);
+
+    for (nr = 0; nr < MPSC_PRODUCERS; nr++) {
+        prods[nr].q = q;
+        prods[nr].id = nr;
+        prods[nr].done = &done;
+        task = kthread_run(mpsc_producer_thread, &prods[nr], "ego_kunit/%u", nr);
+        if (IS_ERR(task)) {
+            KUNIT_FAIL(test, "no producer thread: %ld", PTR_ERR(task));
+            break;
+        }
+    }
+
+    /*
+     * Every item once, and each producer's items in the order pushed. No
+     * asserts in here, the producers still use q and done on our stack.
+     */
+    while (got < nr * MPSC_ITEMS) {
+        n = ego_mpsc_pop(q, items, ARRAY_SIZE(items));
+        for (i = 0; i < n; i++) {
+            id = (unsigned long)items[i] >> 24;
+            seq = (unsigned long)items[i] & 0xffffff;
+            if (id >= nr) {
+                KUNIT_FAIL(test, "item %px from no producer", items[i]);
+                continue;
+            }
+            KUNIT_EXPECT_EQ(test, seq, ++next[id]);
+        }
+        got += n;
+        if (!n)
+            cond_resched();
+    }
+    for (i = 0; i < nr; i++)
+        wait_for_completion(&done);
+
+    KUNIT_EXPECT_EQ(test, ego_mpsc_pop(q, items, 1), 0U);
+    ego_mpsc_free(q);
+}
+
+static void ego_lock_bench(struct kunit *test)
+{
+    spinlock_t spin;
+    struct mutex mtx;
+    u64 i, t0, ns;
+
+    spin_lock_init(&spin);
+    mutex_init(&mtx);
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < EGO_BENCH_OPS; i++) {
+        spin_lock(&spin);
+        spin_unlock(&spin);
+    }
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "spin_lock/unlock", ns, EGO_BENCH_OPS, 1000);
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < EGO_BENCH_OPS; i++) {
+        mutex_lock(&mtx);
+        mutex_unlock(&mtx);
+    }
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "mutex_lock/unlock", ns, EGO_BENCH_OPS, 1000);
+}
+
+static void ego_queue_bench(struct kunit *test)
+{
+    struct ego_spsc *sq = ego_spsc_alloc(10);
+    struct ego_mpsc *mq = ego_mpsc_alloc(10);
+    void *items[16] = { NULL };
+    u64 i, t0, ns;
+
+    KUNIT_ASSERT_NOT_NULL(test, sq);
+    KUNIT_ASSERT_NOT_NULL(test, mq);
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < EGO_BENCH_OPS; i++) {
+        ego_spsc_push(sq, items, 1);
+        ego_spsc_pop(sq, items, 1);
+    }
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "spsc push+pop", ns, EGO_BENCH_OPS, 1000);
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < EGO_BENCH_OPS; i++) {
+        ego_mpsc_push(mq, items, 1);
+        ego_mpsc_pop(mq, items, 1);
+    }
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "mpsc push+pop", ns, EGO_BENCH_OPS, 1000);
+
+    /* Batches pay the shared index traffic once per 16 items */
+    t0 = ktime_get_ns();
+    for (i = 0; i < EGO_BENCH_OPS / 16; i++) {
+        ego_mpsc_push(mq, items, 16);
+        ego_mpsc_pop(mq, items, 16);
+    }
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "mpsc push+pop x16", ns, EGO_BENCH_OPS / 16 * 16, 1000);
+
+    ego_spsc_free(sq);
+    ego_mpsc_free(mq);
+}
+
+static struct kunit_case ego_lock_cases[] = {
+    KUNIT_CASE(ego_spsc_fifo_test),
+    KUNIT_CASE(ego_mpsc_fifo_test),
+    KUNIT_CASE(ego_mpsc_producers_test),
+    KUNIT_CASE(ego_lock_bench),
+    KUNIT_CASE(ego_queue_bench),
+    {}
+};
+
+static struct kunit_suite ego_lock_suite = {
+    .name = "ego_lock",
+    .test_cases = ego_lock_cases,
+};
+
+/* Notifier: a raw chain shaped like the one notified.c exports */
+
+struct ego_kunit_nb {
+    struct notifier_block nb;
+    unsigned int nr;
+    unsigned int slot;      /* where in the dispatch it was called last */
+    u64 seq;
+};
+
+/* Callbacks run so far, across the whole chain */
+static unsigned int ego_kunit_calls;
+
+static int ego_kunit_nb_1(struct notifier_block *nb, unsigned long action, void *data)
+{
+    struct ego_kunit_nb *k = container_of(nb, struct ego_kunit_nb, nb);
+    struct ego_notifier_event *ev = data;
+
+    k->nr++;
+    k->slot = ego_kunit_calls++;
+    k->seq = ev->seq;
+    return NOTIFY_OK;
+}
+
+static int ego_kunit_nb_stop(struct notifier_block *nb, unsigned long action, void *data)
+{
+    struct ego_kunit_nb *k = container_of(nb, struct ego_kunit_nb, nb);
+
+    k->nr++;
+    return NOTIFY_STOP;
+}
+
+static void ego_notifier_order_test(struct kunit *test)
+{
+    RAW_NOTIFIER_HEAD(head);
+    struct ego_kunit_nb low = { .nb = { .notifier_call = ego_kunit_nb_1, .priority = 1 } };
+    struct ego_kunit_nb high = { .nb = { .notifier_call = ego_kunit_nb_1, .priority = 9 } };
+    struct ego_notifier_event ev = { .seq = 42 };
+    int ret;
+
+    KUNIT_ASSERT_EQ(test, raw_notifier_chain_register(&head, &low.nb), 0);
+    KUNIT_ASSERT_EQ(test, raw_notifier_chain_register(&head, &high.nb), 0);
+
+    ego_kunit_calls = 0;
+    ret = raw_notifier_call_chain(&head, 0, &ev);
+    KUNIT_EXPECT_EQ(test, ret, NOTIFY_OK);
+    /* Higher priority first, whatever the order they registered in */
+    KUNIT_EXPECT_EQ(test, high.nr, 1U);
+    KUNIT_EXPECT_EQ(test, low.nr, 1U);
+    KUNIT_EXPECT_EQ(test, high.slot, 0U);
+    KUNIT_EXPECT_EQ(test, low.slot, 1U);
+    /* And both saw the caller's event */
+    KUNIT_EXPECT_EQ(test, high.seq, 42ULL);
+    KUNIT_EXPECT_EQ(test, low.seq, 42ULL);
+
+    raw_notifier_chain_unregister(&head, &high.nb);
+    raw_notifier_call_chain(&head, 0, &ev);
+    KUNIT_EXPECT_EQ(test, high.nr, 1U);
+    KUNIT_EXPECT_EQ(test, low.nr, 2U);
+
+    raw_notifier_chain_unregister(&head, &low.nb);
+}
+
+static void ego_notifier_stop_test(struct kunit *test)
+{
+    RAW_NOTIFIER_HEAD(head);
+    struct ego_kunit_nb stop = { .nb = { .notifier_call = ego_kunit_nb_stop, .priority = 5 } };
+    struct ego_kunit_nb after = { .nb = { .notifier_call = ego_kunit_nb_1, .priority = 0 } };
+    struct ego_notifier_event ev = { .seq = 1 };
+    int ret;
+
+    raw_notifier_chain_register(&head, &stop.nb);
+    raw_notifier_chain_register(&head, &after.nb);
+
+    ret = raw_notifier_call_chain(&head, 0, &ev);
+    KUNIT_EXPECT_TRUE(test, ret & NOTIFY_STOP_MASK);
+    KUNIT_EXPECT_EQ(test, stop.nr, 1U);
+    KUNIT_EXPECT_EQ(test, after.nr, 0U);
+
+    raw_notifier_chain_unregister(&head, &stop.nb);
+    raw_notifier_chain_unregister(&head, &after.nb);
+}
+
+static void ego_notifier_bench(struct kunit *test)
+{
+    RAW_NOTIFIER_HEAD(raw);
+    struct atomic_notifier_head atomic;
+    struct blocking_notifier_head blocking;
+    struct ego_kunit_nb nbs[3];
+    struct ego_notifier_event ev = { .seq = 1 };
+    u64 i, t0, ns;
+    int n;
+
+    ATOMIC_INIT_NOTIFIER_HEAD(&atomic);
+    BLOCKING_INIT_NOTIFIER_HEAD(&blocking);
+
+    /* Three callbacks, as many as notified.c registers */
+    for (n = 0; n < 3; n++) {
+        nbs[n] = (struct ego_kunit_nb){ .nb = { .notifier_call = ego_kunit_nb_1 } };
+        raw_notifier_chain_register(&raw, &nbs[n].nb);
+    }
+    t0 = ktime_get_ns();
+    for (i = 0; i < EGO_BENCH_OPS; i++)
+        raw_notifier_call_chain(&raw, 0, &ev);
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "raw chain x3", ns, EGO_BENCH_OPS, 2000);
+    for (n = 0; n < 3; n++)
+        raw_notifier_chain_unregister(&raw, &nbs[n].nb);
+
+    for (n = 0; n < 3; n++)
+        atomic_notifier_chain_register(&atomic, &nbs[n].nb);
+    t0 = ktime_get_ns();
+    for (i = 0; i < EGO_BENCH_OPS; i++)
+        atomic_notifier_call_chain(&atomic, 0, &ev);
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "atomic chain x3", ns, EGO_BENCH_OPS, 2000);
+    for (n = 0; n < 3; n++)
+        atomic_notifier_chain_unregister(&atomic, &nbs[n].nb);
+
+    for (n = 0; n < 3; n++)
+        blocking_notifier_chain_register(&blocking, &nbs[n].nb);
+    t0 = ktime_get_ns();
+    for (i = 0; i < EGO_BENCH_OPS; i++)
+        blocking_notifier_call_chain(&blocking, 0, &ev);
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "blocking chain x3", ns, EGO_BENCH_OPS, 2000);
+    for (n = 0; n < 3; n++)
+        blocking_notifier_chain_unregister(&blocking, &nbs[n].nb);
+}
+
+static struct kunit_case ego_notifier_cases[] = {
+    KUNIT_CASE(ego_notifier_order_test),
+    KUNIT_CASE(ego_notifier_stop_test),
+    KUNIT_CASE(ego_notifier_bench),
+    {}
+};
+
+static struct kunit_suite ego_notifier_suite = {
+    .name = "ego_notifier",
+    .test_cases = ego_notifier_cases,
+};
+
+/* Timer: the wait wheel from concurrency/completion and a plain hrtimer */
+
+static void ego_wheel_early_test(struct kunit *test)
+{
+    struct ego_wheel *wh = kunit_kzalloc(test, sizeof(*wh), GFP_KERNEL);
+    struct ego_waiter w;
+
+    KUNIT_ASSERT_NOT_NULL(test, wh);
+    ego_wheel_init(wh);
+
+    /* Woken or cancelled before the wait, the wait returns at once */
+    ego_waiter_init(&w);
+    KUNIT_EXPECT_TRUE(test, ego_wait_wake(wh, &w));
+    KUNIT_EXPECT_FALSE(test, ego_wait_cancel(wh, &w));
+    KUNIT_EXPECT_EQ(test, ego_wait_timeout(wh, &w, HZ), 0);
+
+    ego_waiter_init(&w);
+    KUNIT_EXPECT_TRUE(test, ego_wait_cancel(wh, &w));
+    KUNIT_EXPECT_EQ(test, ego_wait_timeout(wh, &w, HZ), -ECANCELED);
+
+    KUNIT_EXPECT_EQ(test, wh->wakes, 1ULL);
+    KUNIT_EXPECT_EQ(test, wh->cancels, 1ULL);
+    KUNIT_EXPECT_EQ(test, wh->pending, 0U);
+
+    /* A stopped wheel turns every new waiter away */
+    ego_wheel_stop(wh);
+    ego_waiter_init(&w);
+    KUNIT_EXPECT_EQ(test, ego_wait_timeout(wh, &w, HZ), -ECANCELED);
+}
+
+static void ego_wheel_timeout_test(struct kunit *test)
+{
+    struct ego_wheel *wh = kunit_kzalloc(test, sizeof(*wh), GFP_KERNEL);
+    struct ego_waiter w;
+    unsigned long t0, timeout;
+
+    KUNIT_ASSERT_NOT_NULL(test, wh);
+    ego_wheel_init(wh);
+
+    /* One deadline on level 0 and one that has to cascade from level 1 */
+    for (timeout = 3; timeout <= 3 + EGO_WHEEL_SIZE; timeout += EGO_WHEEL_SIZE) {
+        ego_waiter_init(&w);
+        t0 = jiffies;
+        KUNIT_EXPECT_EQ(test, ego_wait_timeout(wh, &w, timeout), -ETIMEDOUT);
+        KUNIT_EXPECT_GE(test, jiffies - t0, timeout);
+        /* Never early, and not late by more than a busy guest explains */
+        KUNIT_EXPECT_LE(test, jiffies - t0, timeout + HZ / 2);
+    }
+    KUNIT_EXPECT_EQ(test, wh->timeouts, 2ULL);
+    KUNIT_EXPECT_EQ(test, wh->pending, 0U);
+
+    ego_wheel_stop(wh);
+}
+
+struct wheel_waker {
+    struct delayed_work work;
+    struct ego_wheel *wh;
+    struct ego_waiter *w;
+    bool all;
+};
+
+static void wheel_waker_fn(struct work_struct *work)
+{
+    struct wheel_waker *ww = container_of(work, struct wheel_waker, work.work);
+
+    if (!ww->all) {
+        ego_wait_wake(ww->wh, ww->w);
+        return;
+    }
+
+    /* Early for the waiter, a wake would stick but cancel_all would not */
+    while (!ego_wheel_cancel_all(ww->wh))
+        schedule_timeout_uninterruptible(1);
+}
+
+static void ego_wheel_wake_test(struct kunit *test)
+{
+    struct ego_wheel *wh = kunit_kzalloc(test, sizeof(*wh), GFP_KERNEL);
+    struct wheel_waker ww;
+    struct ego_waiter w;
+
+    KUNIT_ASSERT_NOT_NULL(test, wh);
+    ego_wheel_init(wh);
+    INIT_DELAYED_WORK_ONSTACK(&ww.work, wheel_waker_fn);
+    ww.wh = wh;
+    ww.w = &w;
+
+    /* Woken while queued, and off the wheel right after */
+    ego_waiter_init(&w);
+    ww.all = false;
+    schedule_delayed_work(&ww.work, 2);
+    KUNIT_EXPECT_EQ(test, ego_wait_timeout(wh, &w, 10 * HZ), 0);
+    KUNIT_EXPECT_EQ(test, wh->pending, 0U);
+    flush_delayed_work(&ww.work);
+
+    /* A far deadline sits on a high level, cancel_all still finds it */
+    ego_waiter_init(&w);
+    ww.all = true;
+    schedule_delayed_work(&ww.work, 2);
+    KUNIT_EXPECT_EQ(test, ego_wait_timeout(wh, &w, EGO_WHEEL_MAX), -ECANCELED);
+    KUNIT_EXPECT_EQ(test, wh->pending, 0U);
+    flush_delayed_work(&ww.work);
+
+    destroy_delayed_work_on_stack(&ww.work);
+    ego_wheel_stop(wh);
+}
+
+#define WHEEL_BENCH_WAITERS 10000
+
+static void ego_wheel_bench(struct kunit *test)
+{
+    struct ego_wheel *wh = kunit_kzalloc(test, sizeof(*wh), GFP_KERNEL);
+    struct ego_waiter *ws;
+    u64 i, t0, ns, woken = 0;
+
+    KUNIT_ASSERT_NOT_NULL(test, wh);
+    ws = kvcalloc(WHEEL_BENCH_WAITERS, sizeof(*ws), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, ws);
+    ego_wheel_init(wh);
+    for (i = 0; i < WHEEL_BENCH_WAITERS; i++)
+        ego_waiter_init(&ws[i]);
+
+    /*
+     * What a waiter costs the wheel, queue plus wake, without sleeping.
+     * Deadlines are at least 10s out and spread over every level, so none
+     * of them times out under our feet.
+     */
+    t0 = ktime_get_ns();
+    for (i = 0; i < WHEEL_BENCH_WAITERS; i++) {
+        KUNIT_EXPECT_EQ(test, ego_wait_queue(wh, &ws[i],
+                10 * HZ + get_random_u32_below(EGO_WHEEL_MAX - 10 * HZ)), -EINPROGRESS);
+    }
+    for (i = 0; i < WHEEL_BENCH_WAITERS; i++)
+        woken += ego_wait_wake(wh, &ws[i]);
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "wheel queue+wake", ns, WHEEL_BENCH_WAITERS, 2000);
+    KUNIT_EXPECT_EQ(test, woken, (u64)WHEEL_BENCH_WAITERS);
+    KUNIT_EXPECT_EQ(test, wh->pending, 0U);
+
+    ego_wheel_stop(wh);
+    kvfree(ws);
+}
+
+struct hrtimer_probe {
+    struct hrtimer timer;
+    struct completion done;
+    u64 fired_ns;
+};
+
+static enum hrtimer_restart hrtimer_probe_fn(struct hrtimer *t)
+{
+    struct hrtimer_probe *p = container_of(t, struct hrtimer_probe, timer);
+
+    p->fired_ns = ktime_get_ns();
+    complete(&p->done);
+    return HRTIMER_NORESTART;
+}
+
+static void ego_hrtimer_test(struct kunit *test)
+{
+    struct hrtimer_probe p;
+    u64 t0, late = 0;
+    int i;
+
+    hrtimer_init_on_stack(&p.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    p.timer.function = hrtimer_probe_fn;
+    for (i = 0; i < 10; i++) {
+        init_completion(&p.done);
+        t0 = ktime_get_ns();
+        hrtimer_start(&p.timer, ns_to_ktime(100 * NSEC_PER_USEC), HRTIMER_MODE_REL);
+        wait_for_completion(&p.done);
+        KUNIT_EXPECT_GE(test, p.fired_ns - t0, 100 * NSEC_PER_USEC);
+        late += p.fired_ns - t0 - 100 * NSEC_PER_USEC;
+    }
+    hrtimer_cancel(&p.timer);
+    destroy_hrtimer_on_stack(&p.timer);
+
+    ego_bench_check(test, "hrtimer 100us lateness", late, 10, 1000 * NSEC_PER_USEC);
+}
+
+static struct kunit_case ego_timer_cases[] = {
+    KUNIT_CASE(ego_wheel_early_test),
+    KUNIT_CASE_SLOW(ego_wheel_timeout_test),
+    KUNIT_CASE(ego_wheel_wake_test),
+    KUNIT_CASE(ego_wheel_bench),
+    KUNIT_CASE(ego_hrtimer_test),
+    {}
+};
+
+static struct kunit_suite ego_timer_suite = {
+    .name = "ego_timer",
+    .test_cases = ego_timer_cases,
+};
+
+/* ADT: the indexed containers ADT/ego_adt.c benchmarks, on keys 0..n-1 */
+
+#define ADT_KUNIT_N         4096
+
+struct adt_kunit_node {
+    struct rb_node rb;
+    struct hlist_node hnode;
+    u64 key;
+};
+
+static struct adt_kunit_node *adt_kunit_rb_find(struct rb_root *root, u64 key)
+{
+    struct rb_node *n = root->rb_node;
+    struct adt_kunit_node *e;
+
+    while (n) {
+        e = rb_entry(n, struct adt_kunit_node, rb);
+        if (key < e->key)
+            n = n->rb_left;
+        else if (key > e->key)
+            n = n->rb_right;
+        else
+            return e;
+    }
+
+    return NULL;
+}
+
+static void adt_kunit_rb_insert(struct rb_root *root, struct adt_kunit_node *e)
+{
+    struct rb_node **link = &root->rb_node, *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        if (e->key < rb_entry(parent, struct adt_kunit_node, rb)->key)
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
+    }
+    rb_link_node(&e->rb, parent, link);
+    rb_insert_color(&e->rb, root);
+}
+
+static struct adt_kunit_node *adt_kunit_nodes(struct kunit *test)
+{
+    struct adt_kunit_node *nodes;
+    u64 i, j;
+
+    nodes = kunit_kcalloc(test, ADT_KUNIT_N, sizeof(*nodes), GFP_KERNEL);
+    if (!nodes)
+        return NULL;
+
+    /* Keys in random order, like the ADT module inserts them */
+    for (i = 0; i < ADT_KUNIT_N; i++)
+        nodes[i].key = i;
+    for (i = ADT_KUNIT_N - 1; i > 0; i--) {
+        j = get_random_u32_below(i + 1);
+        swap(nodes[i].key, nodes[j].key);
+    }
+
+    return nodes;
+}
+
+static void ego_adt_rbtree_test(struct kunit *test)
+{
+    struct adt_kunit_node *nodes = adt_kunit_nodes(test), *e;
+    struct rb_root root = RB_ROOT;
+    struct rb_node *n;
+    u64 i, expect = 0, t0, ns;
+
+    KUNIT_ASSERT_NOT_NULL(test, nodes);
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < ADT_KUNIT_N; i++)
+        adt_kunit_rb_insert(&root, &nodes[i]);
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "rbtree insert", ns, ADT_KUNIT_N, 2000);
+
+    /* In order walk comes out sorted and complete */
+    for (n = rb_first(&root); n; n = rb_next(n))
+        KUNIT_EXPECT_EQ(test, rb_entry(n, struct adt_kunit_node, rb)->key, expect++);
+    KUNIT_EXPECT_EQ(test, expect, (u64)ADT_KUNIT_N);
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < ADT_KUNIT_N; i++) {
+        e = adt_kunit_rb_find(&root, i);
+        KUNIT_EXPECT_TRUE(test, e && e->key == i);
+    }
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "rbtree lookup", ns, ADT_KUNIT_N, 2000);
+    KUNIT_EXPECT_NULL(test, adt_kunit_rb_find(&root, ADT_KUNIT_N));
+
+    for (i = 0; i < ADT_KUNIT_N; i += 2)
+        rb_erase(&adt_kunit_rb_find(&root, i)->rb, &root);
+    for (i = 0; i < ADT_KUNIT_N; i++)
+        KUNIT_EXPECT_EQ(test, !!adt_kunit_rb_find(&root, i), !!(i & 1));
+}
+
+struct adt_kunit_hash {
+    DECLARE_HASHTABLE(table, 10);
+};
+
+static void ego_adt_hash_test(struct kunit *test)
+{
+    struct adt_kunit_node *nodes = adt_kunit_nodes(test), *e;
+    struct adt_kunit_hash *h = kunit_kzalloc(test, sizeof(*h), GFP_KERNEL);
+    u64 i, t0, ns, found;
+
+    KUNIT_ASSERT_NOT_NULL(test, nodes);
+    KUNIT_ASSERT_NOT_NULL(test, h);
+    hash_init(h->table);
+
+    for (i = 0; i < ADT_KUNIT_N; i++)
+        hash_add(h->table, &nodes[i].hnode, nodes[i].key);
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < ADT_KUNIT_N; i++) {
+        found = 0;
+        hash_for_each_possible(h->table, e, hnode, i)
+            found += e->key == i;
+        KUNIT_EXPECT_EQ(test, found, 1ULL);
+    }
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "hash lookup", ns, ADT_KUNIT_N, 2000);
+
+    for (i = 0; i < ADT_KUNIT_N; i++)
+        hash_del(&nodes[i].hnode);
+    KUNIT_EXPECT_TRUE(test, hash_empty(h->table));
+}
+
+static void ego_adt_xarray_test(struct kunit *test)
+{
+    struct adt_kunit_node *nodes = adt_kunit_nodes(test);
+    struct xarray xa;
+    unsigned long idx, nr = 0;
+    void *entry;
+    u64 i, t0, ns;
+
+    KUNIT_ASSERT_NOT_NULL(test, nodes);
+    xa_init(&xa);
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < ADT_KUNIT_N; i++)
+        KUNIT_ASSERT_EQ(test, xa_err(xa_store(&xa, nodes[i].key, &nodes[i], GFP_KERNEL)), 0);
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "xarray store", ns, ADT_KUNIT_N, 5000);
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < ADT_KUNIT_N; i++) {
+        entry = xa_load(&xa, i);
+        KUNIT_EXPECT_TRUE(test, entry && ((struct adt_kunit_node *)entry)->key == i);
+    }
+    ns = ktime_get_ns() - t0;
+    ego_bench_check(test, "xarray load", ns, ADT_KUNIT_N, 2000);
+
+    /* A range walk sees exactly the keys of the window, in order */
+    xa_for_each_range(&xa, idx, entry, 100, 199)
+        KUNIT_EXPECT_EQ(test, (u64)idx, 100 + (u64)nr++);
+    KUNIT_EXPECT_EQ(test, nr, 100UL);
+
+    xa_destroy(&xa);
+    KUNIT_EXPECT_TRUE(test, xa_empty(&xa));
+}
+
+static struct kunit_case ego_adt_cases[] = {
+    KUNIT_CASE(ego_adt_rbtree_test),
+    KUNIT_CASE(ego_adt_hash_test),
+    KUNIT_CASE(ego_adt_xarray_test),
+    {}
+};
+
+static struct kunit_suite ego_adt_suite = {
+    .name = "ego_adt",
+    .test_cases = ego_adt_cases,
+};
+
+kunit_test_suites(&ego_lock_suite, &ego_notifier_suite, &ego_timer_suite, &ego_adt_suite);
+
+MODULE_AUTHOR("Manfred <1259106665@qq.com>");
+MODULE_LICENSE("GPL");
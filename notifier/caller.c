@@ -5,55 +5,127 @@
 #include <linux/fs.h>
 #include <linux/notifier.h>
 #include <linux/kthread.h>
-
-extern struct raw_notifier_head ego_notifier;
-
-static bool debug_option = true;    /* hard-code control */
-
-#define ego_err(chip, fmt, ...)     \
-    pr_err("%s: %s " fmt, chip->name,   \
-        __func__, ##__VA__ARGS__)
-
-#define ego_info(chip, fmt, ...)    \
-    do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_info("%s: %s " fmt, chip->name, \
-                __func__, ##__VA_ARGS__);       \
-        else                                    \
-            ;   \
-    } while(0)
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/atomic.h>
+
+#include "egoist.h"
+#include "ego_trace.h"
+#include "ego_pool.h"
+#include "ego_notifier.h"
+#include "ego_cpu.h"
+
+/* One caller per node with CPUs, allocated there */
+struct ego_caller_node {
+    struct task_struct *task;
+    int nid;
+};
 
 typedef struct _egoist {
-    char *name;
-    struct task_struct *task_caller;
-    bool debug_on;
+    struct ego_core core;
+    struct ego_stat *stat_calls;
+    struct ego_stat *stat_chain;
+    struct ego_pool *events;    /* every dispatch carries one */
+    struct ego_cpuhp hp;
+    struct ego_caller_node **nodes;
+    atomic64_t seq;
 }egoist, *pegoist;
 pegoist chip;
 
+static void ego_free(struct ego_core *core)
+{
+    pegoist chip = container_of(core, egoist, core);
+
+    kfree(chip->nodes);
+    kfree(chip);
+}
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        if (!IS_ERR_OR_NULL(chip->task_caller)) {
-            kthread_stop(chip->task_caller);
-        }
-        kfree(chip);
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
 }
 
+static void ego_events_destroy(void *data)
+{
+    ego_pool_destroy(data);
+}
+
 static int caller_thread(void *data)
 {
-    ego_info(chip, "Enter\n");
-    raw_notifier_call_chain(&ego_notifier, 0, NULL);
+    struct ego_caller_node *cn = data;
+    struct ego_notifier_event *ev;
+    u64 t0, ns;
+    int ret;
+
+    ego_info(chip, "Enter on node %d\n", cn->nid);
+    ev = ego_pool_alloc(chip->events, GFP_KERNEL);
+    if (!ev)
+        goto out;
+
+    trace_ego_notifier_dispatch_start(chip->core.name, 0);
+    t0 = ktime_get_ns();
+    ev->seq = atomic64_inc_return(&chip->seq);
+    ev->ts_ns = t0;
+    ev->action = 0;
+    ret = raw_notifier_call_chain(&ego_notifier, ev->action, ev);
+    ns = ktime_get_ns() - t0;
+    ego_counter_inc(chip->stat_calls);
+    ego_hist_record(chip->stat_chain, ns);
+    ego_record(chip, EGO_FLIGHT_NOTIFY, ev->seq, ret, ns);
+    trace_ego_notifier_dispatch_end(chip->core.name, 0, ret);
+    ego_pool_free(chip->events, ev);
+out:
     ego_info(chip, "Exit\n");
 
-    while (!kthread_should_stop())
-        ;
+    /* Nothing left to do, sleep until we are stopped */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
     
     return 0;
 }
 
+/* Runs before the first CPU of @nid comes up */
+static int ego_caller_node_online(struct ego_cpuhp *hp, int nid)
+{
+    pegoist chip = container_of(hp, egoist, hp);
+    struct ego_caller_node *cn;
+    int ret;
+
+    cn = kzalloc_node(sizeof(*cn), GFP_KERNEL, nid);
+    if (!cn)
+        return -ENOMEM;
+
+    cn->nid = nid;
+    cn->task = ego_kthread_run_on_node(caller_thread, cn, nid, "egoist_caller");
+    if (IS_ERR(cn->task)) {
+        ret = PTR_ERR(cn->task);
+        kfree(cn);
+        return ret;
+    }
+    chip->nodes[nid] = cn;
+
+    return 0;
+}
+
+/* Runs after the last CPU of @nid went down */
+static void ego_caller_node_offline(struct ego_cpuhp *hp, int nid)
+{
+    pegoist chip = container_of(hp, egoist, hp);
+    struct ego_caller_node *cn = chip->nodes[nid];
+
+    kthread_stop(cn->task);
+    chip->nodes[nid] = NULL;
+    kfree(cn);
+}
+
 static int __init ego_caller_init(void)
 {
     int ret = 0;
@@ -61,14 +133,37 @@ static int __init ego_caller_init(void)
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
 
-        chip->name = "egoist";
-        chip->debug_on = true;
+        ret = ego_core_setup(&chip->core, "egoist", ego_free);
+        if (ret)
+            break;
+
+        chip->stat_calls = ego_counter_create(chip->core.stats, "chain_calls");
+        chip->stat_chain = ego_hist_create(chip->core.stats, "chain_ns");
+
+        chip->events = ego_pool_create(sizeof(struct ego_notifier_event), 16,
+                "%s_events", chip->core.instance);
+        if (!chip->events) {
+            ret = -ENOMEM;
+            break;
+        }
+        ret = ego_core_add_action(&chip->core, ego_events_destroy, chip->events);
+        if (ret)
+            break;
 
-        chip->task_caller = kthread_run(&caller_thread, 0, "egoist_caller");
+        chip->nodes = kcalloc(nr_node_ids, sizeof(*chip->nodes), GFP_KERNEL);
+        if (!chip->nodes) {
+            ret = -ENOMEM;
+            break;
+        }
+        chip->hp.node_online = ego_caller_node_online;
+        chip->hp.node_offline = ego_caller_node_offline;
+        ret = ego_cpuhp_add(&chip->core, &chip->hp);
+        if (ret)
+            break;
 
     } while (0);
 
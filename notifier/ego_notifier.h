@@ -0,0 +1,16 @@
+#ifndef _EGO_NOTIFIER_H
+#define _EGO_NOTIFIER_H
+
+#include <linux/notifier.h>
+#include <linux/types.h>
+
+extern struct raw_notifier_head ego_notifier;
+
+/* Handed to every callback as @data, owned by the caller for one dispatch */
+struct ego_notifier_event {
+    u64 seq;
+    u64 ts_ns;
+    unsigned long action;
+};
+
+#endif /* _EGO_NOTIFIER_H */
@@ -4,27 +4,15 @@
 #include <linux/platform_device.h>
 #include <linux/fs.h>
 
-static bool debug_option = true;    /* hard-code control */
-
-#define ego_err(chip, fmt, ...)     \
-    pr_err("%s: %s " fmt, chip->name,   \
-        __func__, ##__VA__ARGS__)
-
-#define ego_info(chip, fmt, ...)    \
-    do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_info("%s: %s " fmt, chip->name, \
-                __func__, ##__VA_ARGS__);       \
-        else                                    \
-            ;   \
-    } while(0)
+#include "egoist.h"
+#include "ego_notifier.h"
 
 typedef struct _egoist {
-    char *name;
+    struct ego_core core;
     struct notifier_block notifier_2;
     struct notifier_block notifier_1;
     struct notifier_block notifier_3;
-    bool debug_on;
+    struct ego_stat *stat_notified;
 }egoist, *pegoist;
 pegoist chip;
 
@@ -34,16 +22,20 @@ EXPORT_SYMBOL_GPL(ego_notifier);
 int notifier_1_callback(struct notifier_block *nb, unsigned long action, void *data)
 {
     pegoist dev = container_of(nb, egoist, notifier_1);
+    struct ego_notifier_event *ev = data;
 
-    ego_info(dev, "Notified!\n");
+    ego_info(dev, "Notified! seq=%llu\n", ev ? ev->seq : 0);
+    ego_counter_inc(dev->stat_notified);
     return 0;
 }
 
 int notifier_2_callback(struct notifier_block *nb, unsigned long action, void *data)
 {
     pegoist dev = container_of(nb, egoist, notifier_2);
+    struct ego_notifier_event *ev = data;
 
-    ego_info(dev, "Notified!\n");
+    ego_info(dev, "Notified! seq=%llu\n", ev ? ev->seq : 0);
+    ego_counter_inc(dev->stat_notified);
     return 0;
 
 }
@@ -51,27 +43,41 @@ int notifier_2_callback(struct notifier_block *nb, unsigned long action, void *d
 int notifier_3_callback(struct notifier_block *nb, unsigned long action, void *data)
 {
     pegoist dev = container_of(nb, egoist, notifier_3);
+    struct ego_notifier_event *ev = data;
 
-    ego_info(dev, "Notified!\n");
+    ego_info(dev, "Notified! seq=%llu\n", ev ? ev->seq : 0);
+    ego_counter_inc(dev->stat_notified);
     return 0;
 }
 
+EGO_DEFINE_RELEASE(ego_free, egoist)
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        raw_notifier_chain_unregister(&ego_notifier, &chip->notifier_1);
-        raw_notifier_chain_unregister(&ego_notifier, &chip->notifier_2);
-        raw_notifier_chain_unregister(&ego_notifier, &chip->notifier_3);
-        kfree(chip);
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
 }
 
-void chip_init(pegoist chip)
+static void ego_notifier_unregister(void *data)
 {
-    chip->name = "egoist";
-    chip->debug_on = true;
+    pegoist chip = data;
+
+    raw_notifier_chain_unregister(&ego_notifier, &chip->notifier_1);
+    raw_notifier_chain_unregister(&ego_notifier, &chip->notifier_2);
+    raw_notifier_chain_unregister(&ego_notifier, &chip->notifier_3);
+}
+
+int chip_init(pegoist chip)
+{
+    int ret;
+
+    ret = ego_core_setup(&chip->core, "egoist", ego_free);
+    if (ret)
+        return ret;
+    chip->stat_notified = ego_counter_create(chip->core.stats, "notified");
     chip->notifier_1.notifier_call = &notifier_1_callback;
     chip->notifier_2.notifier_call = &notifier_2_callback;
     chip->notifier_3.notifier_call = &notifier_3_callback;
@@ -82,6 +88,7 @@ void chip_init(pegoist chip)
     raw_notifier_chain_register(&ego_notifier, &chip->notifier_2);
     raw_notifier_chain_register(&ego_notifier, &chip->notifier_3);
 
+    return ego_core_add_action(&chip->core, ego_notifier_unregister, chip);
 }
 
 static int __init ego_notified_init(void)
@@ -91,10 +98,10 @@ static int __init ego_notified_init(void)
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
-    chip_init(chip);
+        ret = chip_init(chip);
 
     } while (0);
 
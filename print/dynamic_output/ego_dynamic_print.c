@@ -5,43 +5,63 @@
 #include <linux/hrtimer.h>
 #include <linux/ktime.h>
 
-static bool debug_option = true;    /* hard-code control */
+#include "egoist.h"
+#include "ego_trace.h"
 
 #define ego_debug(chip, fmt, ...)    \
     do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_debug("%s: %s " fmt, chip->name, \
+        if ((chip)->core.debug_on && debug_option)        \
+            pr_debug("%s: %s " fmt, (chip)->core.name, \
                 __func__, ##__VA_ARGS__);       \
         else                                    \
             ;   \
     } while(0)
 
 typedef struct _egoist {
-    char *name;
+    struct ego_core core;
     struct hrtimer hrtimer;
     unsigned long relative_time;
-    bool debug_on;
+    struct ego_stat *stat_fires;
+    struct ego_stat *stat_late;
 }egoist, *pegoist;
 pegoist chip;
 
 enum hrtimer_restart hrtimer_callback(struct hrtimer *timer)
 {
     pegoist dev = container_of(timer, egoist, hrtimer);
+    ktime_t expires = hrtimer_get_expires(timer);
+    s64 late = ktime_to_ns(ktime_sub(hrtimer_cb_get_time(timer), expires));
+
     ego_debug(dev, "Called\n");
+    trace_ego_hrtimer_fire(dev->core.name, ktime_to_ns(expires), late);
+
+    ego_counter_inc(dev->stat_fires);
+    ego_hist_record(dev->stat_late, late);
+    ego_record(dev, EGO_FLIGHT_HRTIMER, ktime_to_ns(expires), late, 0);
 
-    hrtimer_forward_now(timer, chip->relative_time);
+    hrtimer_forward_now(timer, dev->relative_time);
     return HRTIMER_RESTART;
 }
 
+EGO_DEFINE_RELEASE(ego_free, egoist)
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        /* Nothins to do in this module */
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
 }
 
+static void ego_hrtimer_stop(void *data)
+{
+    pegoist chip = data;
+
+    if (hrtimer_cancel(&chip->hrtimer))
+        ego_debug(chip, "The timer was still in use...\n");
+}
+
 static int __init ego_dynamic_print_init(void)
 {
     int ret = 0;
@@ -50,16 +70,22 @@ static int __init ego_dynamic_print_init(void)
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
 
-        chip->name = "egoist";
-        chip->debug_on = true;
+        ret = ego_core_setup(&chip->core, "egoist", ego_free);
+        if (ret)
+            break;
         chip->relative_time = 500000000; /* 500ms */
+        chip->stat_fires = ego_counter_create(chip->core.stats, "hrtimer_fires");
+        chip->stat_late = ego_hist_create(chip->core.stats, "hrtimer_late_ns");
         ktime = ktime_set(0, chip->relative_time);
         hrtimer_init(&chip->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
         chip->hrtimer.function = &hrtimer_callback;
+        ret = ego_core_add_action(&chip->core, ego_hrtimer_stop, chip);
+        if (ret)
+            break;
 
         hrtimer_start(&chip->hrtimer, ktime, HRTIMER_MODE_REL);
     } while (0);
@@ -75,14 +101,7 @@ static int __init ego_dynamic_print_init(void)
 
 static void __exit ego_dynamic_print_exit(void)
 {
-    int ret;
-
     ego_release(chip);
-    ret = hrtimer_cancel(&chip->hrtimer);
-    if (ret) {
-        pr_info("The timer was still in use...\n");
-    }
-
     pr_info("All things gone\n");
 }
 
@@ -4,31 +4,19 @@
 #include <linux/platform_device.h>
 #include <linux/fs.h>
 
-static bool debug_option = true;    /* hard-code control */
-
-#define ego_err(chip, fmt, ...)     \
-    pr_err("%s: %s " fmt, chip->name,   \
-        __func__, ##__VA__ARGS__)
-
-#define ego_info(chip, fmt, ...)    \
-    do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_info("%s: %s " fmt, chip->name, \
-                __func__, ##__VA_ARGS__);       \
-        else                                    \
-            ;   \
-    } while(0)
+#include "egoist.h"
 
 typedef struct _egoist {
-    char *name;
-    bool debug_on;
+    struct ego_core core;
 }egoist, *pegoist;
 pegoist chip;
 
+EGO_DEFINE_RELEASE(ego_free, egoist)
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        /* Nothins to do in this module */
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
@@ -41,12 +29,13 @@ static int __init ego_print_init(void)
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
 
-        chip->name = "egoist";
-        chip->debug_on = true;
+        ret = ego_core_setup(&chip->core, "egoist", ego_free);
+        if (ret)
+            break;
 
     } while (0);
 
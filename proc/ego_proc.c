@@ -5,26 +5,18 @@
 #include <linux/fs.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/poll.h>
 
-static bool debug_option = true;    /* hard-code control */
-
-#define ego_err(chip, fmt, ...)     \
-    pr_err("%s: %s " fmt, chip->name,   \
-        __func__, ##__VA__ARGS__)
-
-#define ego_info(chip, fmt, ...)    \
-    do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_info("%s: %s " fmt, chip->name, \
-                __func__, ##__VA_ARGS__);       \
-        else                                    \
-            ;   \
-    } while(0)
+#include "egoist.h"
+#include "ego_trace.h"
+#include "ego_watch.h"
 
 typedef struct _egoist {
-    char *name;
-    bool debug_on;
+    struct ego_core core;
     int proc_val;
+    struct ego_watch watch;     /* bumped on every store to proc_val */
+    struct ego_stat *stat_writes;
+    struct ego_stat *stat_val;
 }egoist, *pegoist;
 pegoist chip;
 
@@ -43,16 +35,25 @@ static int ego_seq_open(struct inode *inode, struct file *filp)
 #define MAX_BUFF    20
 ssize_t ego_proc_write(struct file *filp, const char *buf, size_t size, loff_t *pos)
 {
-    int ret;
+    int ret, old = chip->proc_val;
     char val[MAX_BUFF];
 
+    if (size >= MAX_BUFF)
+        return -EINVAL;
+
     if (copy_from_user(&val, buf, size))
         return -EFAULT;
 
     val[size] = '\0';
 
     ret = kstrtoint(val, 0, &chip->proc_val);
-    
+    if (!ret)
+        ego_watch_bump(&chip->watch);
+    trace_ego_proc_store(chip->core.name, "ego_proc", old, chip->proc_val, ret);
+    ego_record(chip, EGO_FLIGHT_STORE, old, chip->proc_val, ret);
+    ego_counter_inc(chip->stat_writes);
+    ego_gauge_set(chip->stat_val, chip->proc_val);
+
     return size;
 }
 
@@ -62,15 +63,65 @@ static const struct proc_ops ego_proc_ops = {
     .proc_write = ego_proc_write,
 };
 
+/*
+ * One "<generation> <proc_val>" line per change. The file position is the
+ * generation seen last, so a read blocks until proc_val is stored again;
+ * a fresh open returns the current value at once, pread() and lseek() pick
+ * the generation to start after.
+ */
+static ssize_t ego_proc_watch_read(struct file *filp, char __user *buf,
+        size_t size, loff_t *pos)
+{
+    char val[48];
+    u64 gen = *pos;
+    int ret, len;
+
+    ret = ego_watch_wait(&chip->watch, &gen, filp->f_flags & O_NONBLOCK);
+    if (ret)
+        return ret;
+
+    len = scnprintf(val, sizeof(val), "%llu %d\n", gen, READ_ONCE(chip->proc_val));
+    if (size < len)
+        return -EINVAL;
+    if (copy_to_user(buf, val, len))
+        return -EFAULT;
+
+    *pos = gen;
+    return len;
+}
+
+static __poll_t ego_proc_watch_poll(struct file *filp, poll_table *pt)
+{
+    return ego_watch_poll(&chip->watch, filp, pt, filp->f_pos);
+}
+
+static const struct proc_ops ego_proc_watch_ops = {
+    .proc_read = ego_proc_watch_read,
+    .proc_poll = ego_proc_watch_poll,
+};
+
+EGO_DEFINE_RELEASE(ego_free, egoist)
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        /* Nothins to do in this module */
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
 }
 
+static void ego_proc_remove(void *data)
+{
+    remove_proc_entry(data, NULL);
+}
+
+/* Runs first, the entry cannot go while readers sleep in it */
+static void ego_proc_watch_stop(void *data)
+{
+    ego_watch_kill(data);
+}
+
 static int __init ego_print_init(void)
 {
     int ret = 0;
@@ -78,13 +129,33 @@ static int __init ego_print_init(void)
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
 
-        chip->name = "egoist";
-        chip->debug_on = true;
-        proc_create("ego_proc", 0660, NULL, &ego_proc_ops);
+        ret = ego_core_setup(&chip->core, "egoist", ego_free);
+        if (ret)
+            break;
+        chip->stat_writes = ego_counter_create(chip->core.stats, "writes");
+        chip->stat_val = ego_gauge_create(chip->core.stats, "proc_val");
+        ego_watch_init(&chip->watch);
+        if (!proc_create("ego_proc", 0660, NULL, &ego_proc_ops)) {
+            ret = -ENOMEM;
+            break;
+        }
+        ret = ego_core_add_action(&chip->core, ego_proc_remove, "ego_proc");
+        if (ret)
+            break;
+        if (!proc_create("ego_proc_watch", 0440, NULL, &ego_proc_watch_ops)) {
+            ret = -ENOMEM;
+            break;
+        }
+        ret = ego_core_add_action(&chip->core, ego_proc_remove, "ego_proc_watch");
+        if (ret)
+            break;
+        ret = ego_core_add_action(&chip->core, ego_proc_watch_stop, &chip->watch);
+        if (ret)
+            break;
 
     } while (0);
 
@@ -99,7 +170,6 @@ static int __init ego_print_init(void)
 
 static void __exit ego_print_exit(void)
 {
-    remove_proc_entry("ego_proc", NULL);
     ego_release(chip);
     pr_info("All things gone\n");
 }
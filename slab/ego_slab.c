@@ -0,0 +1,389 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/kthread.h>
+
+#include "egoist.h"
+#include "ego_pool.h"
+
+#define SLAB_MAX_RESULTS    128
+#define SLAB_MAX_BATCH      4096
+
+enum {
+    SLAB_KMALLOC = 0,
+    SLAB_CACHE,
+    SLAB_POOL,
+    SLAB_NR_ALLOCS,
+};
+
+static const char * const slab_alloc_name[SLAB_NR_ALLOCS] = {
+    [SLAB_KMALLOC] = "kmalloc",
+    [SLAB_CACHE] = "kmem_cache",
+    [SLAB_POOL] = "ego_pool",
+};
+
+/*
+ * Every worker churns through the same pattern: grab @batch objects, touch
+ * them, give them all back, repeat. The batch is what the allocator has to
+ * absorb per CPU, a batch larger than the pool's per-CPU cap spills.
+ */
+struct slab_worker {
+    struct task_struct *task;
+    void **objs;
+    u64 ops;
+    u64 ns;
+} ____cacheline_aligned_in_smp;
+
+struct slab_result {
+    const char *name;
+    unsigned int cpus;
+    u32 size;
+    u32 batch;
+    u64 ops;
+    u64 ns_per_op;
+    u64 mops;                   /* million alloc+free pairs per second, all CPUs */
+    u64 hit_pct;                /* ego_pool only, served from the per-CPU list */
+};
+
+typedef struct _egoist {
+    struct ego_core core;
+    struct mutex lock;          /* one run at a time, guards results */
+    u32 obj_size;
+    u32 batch;
+    u32 rounds;
+    u32 pool_cpu_max;
+
+    /* Set up for the allocator under test only */
+    int alloc;
+    struct kmem_cache *cache;
+    struct ego_pool *pool;
+    struct slab_worker *workers;
+    struct completion start;
+    atomic_t left;              /* workers still running their rounds */
+    struct completion done;
+
+    struct slab_result results[SLAB_MAX_RESULTS];
+    unsigned int nr_results;
+}egoist, *pegoist;
+pegoist chip;
+
+static __always_inline void *slab_get(pegoist chip)
+{
+    switch (chip->alloc) {
+    case SLAB_KMALLOC:
+        return kmalloc(chip->obj_size, GFP_KERNEL);
+    case SLAB_CACHE:
+        return kmem_cache_alloc(chip->cache, GFP_KERNEL);
+    default:
+        return ego_pool_alloc(chip->pool, GFP_KERNEL);
+    }
+}
+
+static __always_inline void slab_put(pegoist chip, void *obj)
+{
+    switch (chip->alloc) {
+    case SLAB_KMALLOC:
+        kfree(obj);
+        break;
+    case SLAB_CACHE:
+        kmem_cache_free(chip->cache, obj);
+        break;
+    default:
+        ego_pool_free(chip->pool, obj);
+        break;
+    }
+}
+
+static int slab_worker_thread(void *data)
+{
+    struct slab_worker *w = data;
+    u32 batch = min_t(u32, READ_ONCE(chip->batch), SLAB_MAX_BATCH), r, i;
+    u64 ops = 0, t0;
+
+    wait_for_completion(&chip->start);
+
+    t0 = ktime_get_ns();
+    for (r = 0; r < chip->rounds; r++) {
+        for (i = 0; i < batch; i++) {
+            w->objs[i] = slab_get(chip);
+            if (w->objs[i])
+                *(u8 *)w->objs[i] = i;
+        }
+        for (i = 0; i < batch; i++) {
+            if (w->objs[i])
+                slab_put(chip, w->objs[i]);
+        }
+        ops += batch;
+        cond_resched();
+    }
+    w->ns = ktime_get_ns() - t0;
+    w->ops = ops;
+    if (atomic_dec_and_test(&chip->left))
+        complete(&chip->done);
+
+    /* Stay around until the runner collected us */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
+
+    return 0;
+}
+
+static u64 slab_pool_hit_pct(struct ego_pool *pool)
+{
+    struct ego_pool_pcpu *pc;
+    u64 hits = 0, misses = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        pc = per_cpu_ptr(pool->pcpu, cpu);
+        hits += pc->hits;
+        misses += pc->misses;
+    }
+
+    return hits + misses ? div64_u64(hits * 100, hits + misses) : 0;
+}
+
+static int slab_run_alloc(pegoist chip, int alloc, unsigned int cpus)
+{
+    struct slab_result *res;
+    struct slab_worker *w;
+    unsigned int nr = 0, i;
+    u64 ops = 0, ns = 0, mops = 0;
+    int cpu, ret = 0;
+
+    chip->alloc = alloc;
+    init_completion(&chip->start);
+    init_completion(&chip->done);
+    if (alloc == SLAB_CACHE) {
+        /* Named after the instance, so two of them never share a name */
+        chip->cache = kmem_cache_create(chip->core.instance, chip->obj_size, 0,
+                SLAB_HWCACHE_ALIGN, NULL);
+        if (!chip->cache)
+            return -ENOMEM;
+    } else if (alloc == SLAB_POOL) {
+        chip->pool = ego_pool_create(chip->obj_size, chip->pool_cpu_max, "%s_pool",
+                chip->core.instance);
+        if (!chip->pool)
+            return -ENOMEM;
+    }
+
+    cpus_read_lock();
+    for_each_online_cpu(cpu) {
+        if (nr >= cpus)
+            break;
+
+        w = &chip->workers[nr];
+        w->ops = 0;
+        w->ns = 0;
+        w->task = kthread_create(slab_worker_thread, w, "ego_slab/%d", cpu);
+        if (IS_ERR(w->task)) {
+            ret = PTR_ERR(w->task);
+            break;
+        }
+        kthread_bind(w->task, cpu);
+        nr++;
+    }
+    cpus_read_unlock();
+
+    /* Not woken yet, so nobody can count down before we set this */
+    atomic_set(&chip->left, nr);
+    for (i = 0; i < nr; i++)
+        wake_up_process(chip->workers[i].task);
+    complete_all(&chip->start);
+    /* kthread_stop() on a worker that never ran would skip its rounds */
+    if (nr)
+        wait_for_completion(&chip->done);
+
+    for (i = 0; i < nr; i++) {
+        w = &chip->workers[i];
+        kthread_stop(w->task);
+        ops += w->ops;
+        ns += w->ns;
+        mops += w->ns ? div64_u64(w->ops * 1000, w->ns) : 0;
+    }
+
+    if (!ret && ops) {
+        res = &chip->results[chip->nr_results++ % SLAB_MAX_RESULTS];
+        res->name = slab_alloc_name[alloc];
+        res->cpus = nr;
+        res->size = chip->obj_size;
+        res->batch = chip->batch;
+        res->ops = ops;
+        res->ns_per_op = div64_u64(ns, ops);
+        res->mops = mops;
+        res->hit_pct = alloc == SLAB_POOL ? slab_pool_hit_pct(chip->pool) : 0;
+        ego_info(chip, "%s cpus:%u done\n", res->name, nr);
+    }
+
+    ego_pool_destroy(chip->pool);
+    chip->pool = NULL;
+    kmem_cache_destroy(chip->cache);
+    chip->cache = NULL;
+    return ret;
+}
+
+static int slab_run(pegoist chip, unsigned int cpus)
+{
+    int alloc, ret = 0;
+
+    for (alloc = 0; alloc < SLAB_NR_ALLOCS && !ret; alloc++)
+        ret = slab_run_alloc(chip, alloc, cpus);
+
+    return ret;
+}
+
+/* Write a CPU count to run every allocator, or 0 to sweep 1, 2, 4... CPUs */
+static ssize_t slab_run_write(struct file *filp, const char __user *buf,
+        size_t size, loff_t *pos)
+{
+    pegoist dev = filp->private_data;
+    unsigned int cpus, online = num_online_cpus();
+    int ret;
+
+    ret = kstrtouint_from_user(buf, size, 0, &cpus);
+    if (ret)
+        return ret;
+
+    mutex_lock(&dev->lock);
+    if (!dev->batch || dev->batch > SLAB_MAX_BATCH || !dev->obj_size) {
+        ret = -EINVAL;
+    } else if (cpus) {
+        ret = slab_run(dev, min(cpus, online));
+    } else {
+        for (cpus = 1; cpus < online && !ret; cpus <<= 1)
+            ret = slab_run(dev, cpus);
+        if (!ret)
+            ret = slab_run(dev, online);
+    }
+    mutex_unlock(&dev->lock);
+
+    return ret ? ret : size;
+}
+
+static const struct file_operations slab_run_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = slab_run_write,
+};
+
+static int slab_results_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct slab_result *r;
+    unsigned int i, first;
+
+    seq_puts(m, "allocator cpus size batch ops ns_per_op mops pool_hit_pct\n");
+
+    mutex_lock(&dev->lock);
+    first = dev->nr_results > SLAB_MAX_RESULTS ? dev->nr_results - SLAB_MAX_RESULTS : 0;
+    for (i = first; i < dev->nr_results; i++) {
+        r = &dev->results[i % SLAB_MAX_RESULTS];
+        seq_printf(m, "%s %u %u %u %llu %llu %llu %llu\n", r->name, r->cpus,
+                r->size, r->batch, r->ops, r->ns_per_op, r->mops, r->hit_pct);
+    }
+    mutex_unlock(&dev->lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(slab_results);
+
+static void ego_free(struct ego_core *core)
+{
+    pegoist chip = container_of(core, egoist, core);
+    unsigned int i;
+
+    if (chip->workers) {
+        for (i = 0; i < nr_cpu_ids; i++)
+            kfree(chip->workers[i].objs);
+    }
+    kfree(chip->workers);
+    kfree(chip);
+}
+
+void ego_release(pegoist chip)
+{
+    if (chip != NULL) {
+        ego_core_put(&chip->core);
+    } else {
+        pr_err("Failed to alloc mem for egoist\n");
+    }
+}
+
+static int __init ego_slab_init(void)
+{
+    unsigned int i;
+    int ret = 0;
+
+    do {
+        chip = kzalloc(sizeof(*chip), GFP_KERNEL);
+        if (!chip) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        ret = ego_core_setup(&chip->core, "ego_slab", ego_free);
+        if (ret)
+            break;
+        mutex_init(&chip->lock);
+        chip->obj_size = 64;
+        chip->batch = 32;
+        chip->rounds = 100000;
+        chip->pool_cpu_max = 64;
+
+        chip->workers = kcalloc(nr_cpu_ids, sizeof(*chip->workers), GFP_KERNEL);
+        if (!chip->workers) {
+            ret = -ENOMEM;
+            break;
+        }
+        for (i = 0; i < nr_cpu_ids; i++) {
+            chip->workers[i].objs = kcalloc(SLAB_MAX_BATCH, sizeof(void *), GFP_KERNEL);
+            if (!chip->workers[i].objs) {
+                ret = -ENOMEM;
+                break;
+            }
+        }
+        if (ret)
+            break;
+
+        debugfs_create_u32("obj_size", 0644, chip->core.dir, &chip->obj_size);
+        debugfs_create_u32("batch", 0644, chip->core.dir, &chip->batch);
+        debugfs_create_u32("rounds", 0644, chip->core.dir, &chip->rounds);
+        debugfs_create_u32("pool_cpu_max", 0644, chip->core.dir, &chip->pool_cpu_max);
+        debugfs_create_file("run", 0200, chip->core.dir, chip, &slab_run_fops);
+        debugfs_create_file("results", 0444, chip->core.dir, chip, &slab_results_fops);
+
+    } while (0);
+
+    if (ret) {
+        ego_release(chip);
+        return ret;
+    }
+
+    ego_info(chip, "All things goes well, awesome\n");
+    return ret;
+}
+
+static void __exit ego_slab_exit(void)
+{
+    ego_release(chip);
+    pr_info("All things gone\n");
+}
+
+module_init(ego_slab_init);
+module_exit(ego_slab_exit);
+
+MODULE_AUTHOR("Manfred <1259106665@qq.com>");
+MODULE_LICENSE("GPL");
@@ -3,60 +3,210 @@
 #include <linux/kernel.h>
 #include <linux/platform_device.h>
 #include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/completion.h>
 
-static bool debug_option = true;    /* hard-code control */
+#include "egoist.h"
+#include "ego_trace.h"
 
-#define ego_err(chip, fmt, ...)     \
-    pr_err("%s: %s " fmt, chip->name,   \
-        __func__, ##__VA_ARGS__)
+#define KOBJ_MAX_RESULTS    128
 
-#define ego_info(chip, fmt, ...)    \
-    do {                            \
-        if (chip->debug_on && debug_option)        \
-            pr_info("%s: %s " fmt, chip->name, \
-                __func__, ##__VA_ARGS__);       \
-        else                                    \
-            ;   \
-    } while(0)
+/*
+ * What a read sees at once. Stores are serialized by the mutex and publish
+ * a new snapshot under the seqcount, reads copy it without any lock and
+ * retry when a store got in between.
+ */
+struct ego_kobj_snap {
+    unsigned long val;
+    unsigned long gen;          /* bumped by every store that went through */
+    unsigned long sum;          /* val + gen, a torn read does not add up */
+};
+
+/* How the stress test readers get at the snapshot */
+enum {
+    KOBJ_SEQCOUNT = 0,
+    KOBJ_MUTEX,
+    KOBJ_NONE,
+    KOBJ_NR_MODES,
+};
+
+static const char * const kobj_mode_name[KOBJ_NR_MODES] = {
+    [KOBJ_SEQCOUNT] = "seqcount",
+    [KOBJ_MUTEX] = "mutex",
+    [KOBJ_NONE] = "none",
+};
+
+struct kobj_worker {
+    struct task_struct *task;
+    int mode;
+    bool writer;
+    u64 ops;
+    u64 fails;                  /* torn reads, or lost compare-and-swaps */
+    u64 ns;
+} ____cacheline_aligned_in_smp;
+
+struct kobj_result {
+    const char *mode;
+    unsigned int readers;
+    unsigned int writers;
+    u64 reads;
+    u64 ns_per_read;
+    u64 read_mops;              /* million reads per second, all readers */
+    u64 torn;
+    u64 writes;
+    u64 cas_fails;
+};
 
 typedef struct _egoist {
-    char *name;
+    struct ego_core core;
     struct kobject kobj;
-    unsigned long obj_val;
-    bool debug_on;
+    struct kset *kset;
+    struct ego_stat *stat_stores;
+    struct ego_stat *stat_val;
+
+    /* Stress test, one run at a time */
+    struct mutex run_lock;      /* guards results */
+    u32 duration_ms;
+    u32 nr_writers;
+    struct kobj_worker *workers;
+    atomic_t arriving;          /* workers not at the start line yet */
+    struct completion ready;
+    struct completion start;
+    bool stop;
+    struct kobj_result results[KOBJ_MAX_RESULTS];
+    unsigned int nr_results;
+
+    /* Read by every show, written by every store */
+    struct mutex lock EGO_HOT;
+    seqcount_mutex_t seq;
+    struct ego_kobj_snap snap;
 }egoist, *pegoist;
 pegoist chip;
 
+/* The kobject has the last word on the memory it is embedded in */
+static void ego_free(struct ego_core *core)
+{
+    pegoist chip = container_of(core, egoist, core);
+
+    if (chip->kobj.state_initialized) {
+        kobject_put(&chip->kobj);
+    } else {
+        kfree(chip->workers);
+        kfree(chip);
+    }
+}
+
+static void ego_kobj_release(struct kobject *kobj)
+{
+    pegoist chip = container_of(kobj, egoist, kobj);
+
+    kfree(chip->workers);
+    kfree(chip);
+}
+
 void ego_release(pegoist chip)
 {
     if (chip != NULL) {
-        if (&chip->kobj) {
-            kobject_put(&chip->kobj);
-        }
-        kfree(chip);
+        ego_core_put(&chip->core);
     } else {
         pr_err("Failed to alloc mem for egoist\n");
     }
 }
 
+/* Gone from sysfs before the stats its stores update */
+static void ego_kobj_del(void *data)
+{
+    pegoist chip = data;
+
+    kobject_del(&chip->kobj);
+}
+
+static void ego_kset_del(void *data)
+{
+    kset_unregister(data);
+}
+
 static int demo_val;
+
+static void ego_kobj_read(pegoist chip, struct ego_kobj_snap *snap)
+{
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&chip->seq);
+        *snap = chip->snap;
+    } while (read_seqcount_retry(&chip->seq, seq));
+}
+
+/*
+ * Store @val, with @cas only while the value still is @expect. The value
+ * found is left in @old either way. Returns 0 or -EAGAIN.
+ */
+static int ego_kobj_write(pegoist chip, unsigned long val, bool cas,
+        unsigned long expect, unsigned long *old)
+{
+    struct ego_kobj_snap *snap = &chip->snap;
+    int ret = 0;
+
+    mutex_lock(&chip->lock);
+    *old = snap->val;
+    if (cas && snap->val != expect) {
+        ret = -EAGAIN;
+    } else {
+        write_seqcount_begin(&chip->seq);
+        WRITE_ONCE(snap->val, val);
+        WRITE_ONCE(snap->gen, snap->gen + 1);
+        WRITE_ONCE(snap->sum, val + snap->gen);
+        write_seqcount_end(&chip->seq);
+        demo_val = val;
+    }
+    mutex_unlock(&chip->lock);
+
+    return ret;
+}
+
+static struct attribute demo_cas;
+
 ssize_t	demo_show(struct kobject *kobj, struct attribute *attr, char *buf)
 {
     pegoist chip = container_of(kobj, egoist, kobj);
-    
-    return scnprintf(buf, PAGE_SIZE, "cc:%ld\n", chip->obj_val);
+    struct ego_kobj_snap snap;
+
+    ego_kobj_read(chip, &snap);
+    if (attr == &demo_cas)
+        return scnprintf(buf, PAGE_SIZE, "%lu %lu\n", snap.val, snap.gen);
+
+    return scnprintf(buf, PAGE_SIZE, "cc:%ld\n", snap.val);
 }
 
+/* "cas" takes "<expected> <new>" and fails with -EAGAIN when outdated */
 ssize_t	demo_store(struct kobject *kobj, struct attribute *attr, const char *buf, size_t cout)
 {
     int ret;
     pegoist chip = container_of(kobj, egoist, kobj);
+    unsigned long val, expect = 0, old = 0;
+    bool cas = attr == &demo_cas;
     ego_info(chip, "called\n");
-    ret = kstrtoul(buf, 0, &chip->obj_val);
+    if (cas)
+        ret = sscanf(buf, "%lu %lu", &expect, &val) == 2 ? 0 : -EINVAL;
+    else
+        ret = kstrtoul(buf, 0, &val);
+    if (!ret)
+        ret = ego_kobj_write(chip, val, cas, expect, &old);
+    trace_ego_sysfs_store(chip->core.name, attr->name, old, ret ? old : val, ret);
+    ego_record(chip, EGO_FLIGHT_STORE, old, ret ? old : val, ret);
     if (ret)
         return ret;
     
-    demo_val = chip->obj_val;
+    ego_counter_inc(chip->stat_stores);
+    ego_gauge_set(chip->stat_val, val);
 
     return cout;
 }
@@ -76,6 +226,11 @@ static struct attribute demo_2 = {
     .mode = 0664,
 };
 
+static struct attribute demo_cas = {
+    .name = "cas",
+    .mode = 0664,
+};
+
 static struct attribute self = {
     .name = "self",
     .mode = 0664,
@@ -89,6 +244,7 @@ struct attribute *self_attr[] = {
 struct attribute *attr[] = {
     &demo_1,
     &demo_2,
+    &demo_cas,
     NULL
 };
 
@@ -100,10 +256,210 @@ static const struct attribute_group attr_group = {
 static const struct attribute_group *overall_groups = &attr_group;
 
 static struct kobj_type k_type = {
+    .release = ego_kobj_release,
     .sysfs_ops = &demo_ops,
     .default_groups = &overall_groups,
 };
 
+static int kobj_worker_thread(void *data)
+{
+    struct kobj_worker *w = data;
+    struct ego_kobj_snap snap;
+    unsigned long old;
+    u64 ops = 0, fails = 0, t0;
+
+    /* The last one in tells the runner, then all sleep until the start */
+    if (atomic_dec_and_test(&chip->arriving))
+        complete(&chip->ready);
+    wait_for_completion(&chip->start);
+
+    t0 = ktime_get_ns();
+    while (!READ_ONCE(chip->stop)) {
+        if (w->writer) {
+            /* What a userspace read-modify-write through "cas" does */
+            ego_kobj_read(chip, &snap);
+            if (ego_kobj_write(chip, snap.val + 1, true, snap.val, &old))
+                fails++;
+            else
+                ops++;
+        } else {
+            if (w->mode == KOBJ_SEQCOUNT) {
+                ego_kobj_read(chip, &snap);
+            } else if (w->mode == KOBJ_MUTEX) {
+                mutex_lock(&chip->lock);
+                snap = chip->snap;
+                mutex_unlock(&chip->lock);
+            } else {
+                snap.val = READ_ONCE(chip->snap.val);
+                snap.gen = READ_ONCE(chip->snap.gen);
+                snap.sum = READ_ONCE(chip->snap.sum);
+            }
+            if (snap.sum != snap.val + snap.gen)
+                fails++;
+            ops++;
+        }
+
+        if (!((ops + fails) & 1023))
+            cond_resched();
+    }
+    w->ns = ktime_get_ns() - t0;
+    w->ops = ops;
+    w->fails = fails;
+
+    /* Stay around until the runner collected us */
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule();
+        __set_current_state(TASK_RUNNING);
+    }
+
+    return 0;
+}
+
+/* Writers on the first nr_writers online CPUs, @readers readers after them */
+static int kobj_run_mode(pegoist chip, int mode, unsigned int readers)
+{
+    struct kobj_result r;
+    struct kobj_worker *w;
+    unsigned int nr = 0, i;
+    u64 read_ns = 0, mops = 0;
+    int cpu, ret = 0;
+
+    reinit_completion(&chip->ready);
+    reinit_completion(&chip->start);
+    WRITE_ONCE(chip->stop, false);
+    memset(chip->workers, 0, sizeof(*chip->workers) * nr_cpu_ids);
+
+    cpus_read_lock();
+    for_each_online_cpu(cpu) {
+        if (nr >= chip->nr_writers + readers)
+            break;
+
+        w = &chip->workers[nr];
+        w->mode = mode;
+        w->writer = nr < chip->nr_writers;
+        w->task = kthread_create(kobj_worker_thread, w, "ego_kobj/%d", cpu);
+        if (IS_ERR(w->task)) {
+            ret = PTR_ERR(w->task);
+            w->task = NULL;
+            break;
+        }
+        kthread_bind(w->task, cpu);
+        nr++;
+    }
+    cpus_read_unlock();
+
+    /* Not woken yet, so nobody can count down before we set this */
+    atomic_set(&chip->arriving, nr);
+    for (i = 0; i < nr; i++)
+        wake_up_process(chip->workers[i].task);
+
+    if (!ret) {
+        if (nr)
+            wait_for_completion(&chip->ready);
+        complete_all(&chip->start);
+        msleep(chip->duration_ms);
+    }
+    complete_all(&chip->start);
+    WRITE_ONCE(chip->stop, true);
+
+    memset(&r, 0, sizeof(r));
+    for (i = 0; i < nr; i++) {
+        w = &chip->workers[i];
+        kthread_stop(w->task);
+        if (w->writer) {
+            r.writers++;
+            r.writes += w->ops;
+            r.cas_fails += w->fails;
+        } else {
+            r.readers++;
+            r.reads += w->ops;
+            r.torn += w->fails;
+            read_ns += w->ns;
+            mops += w->ns ? div64_u64(w->ops * 1000, w->ns) : 0;
+        }
+    }
+
+    if (!ret && r.reads) {
+        r.mode = kobj_mode_name[mode];
+        r.ns_per_read = div64_u64(read_ns, r.reads);
+        r.read_mops = mops;
+        chip->results[chip->nr_results++ % KOBJ_MAX_RESULTS] = r;
+        ego_info(chip, "%s readers:%u done\n", r.mode, r.readers);
+    }
+
+    return ret;
+}
+
+static int kobj_run(pegoist chip, unsigned int readers)
+{
+    int mode, ret = 0;
+
+    for (mode = 0; mode < KOBJ_NR_MODES && !ret; mode++)
+        ret = kobj_run_mode(chip, mode, readers);
+
+    return ret;
+}
+
+/* Write a reader count to run every mode, or 0 to sweep 1, 2, 4... readers */
+static ssize_t kobj_run_write(struct file *filp, const char __user *buf,
+        size_t size, loff_t *pos)
+{
+    pegoist dev = filp->private_data;
+    unsigned int readers, online = num_online_cpus(), max;
+    int ret;
+
+    ret = kstrtouint_from_user(buf, size, 0, &readers);
+    if (ret)
+        return ret;
+
+    mutex_lock(&dev->run_lock);
+    if (dev->nr_writers >= online) {
+        ret = -EINVAL;
+    } else if (readers) {
+        max = online - dev->nr_writers;
+        ret = kobj_run(dev, min(readers, max));
+    } else {
+        max = online - dev->nr_writers;
+        for (readers = 1; readers < max && !ret; readers <<= 1)
+            ret = kobj_run(dev, readers);
+        if (!ret)
+            ret = kobj_run(dev, max);
+    }
+    mutex_unlock(&dev->run_lock);
+
+    return ret ? ret : size;
+}
+
+static const struct file_operations kobj_run_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = kobj_run_write,
+};
+
+static int kobj_results_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct kobj_result *r;
+    unsigned int i, first;
+
+    seq_puts(m, "mode readers writers reads ns_per_read read_mops torn writes cas_fails\n");
+
+    mutex_lock(&dev->run_lock);
+    first = dev->nr_results > KOBJ_MAX_RESULTS ? dev->nr_results - KOBJ_MAX_RESULTS : 0;
+    for (i = first; i < dev->nr_results; i++) {
+        r = &dev->results[i % KOBJ_MAX_RESULTS];
+        seq_printf(m, "%s %u %u %llu %llu %llu %llu %llu %llu\n", r->mode,
+                r->readers, r->writers, r->reads, r->ns_per_read, r->read_mops,
+                r->torn, r->writes, r->cas_fails);
+    }
+    mutex_unlock(&dev->run_lock);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(kobj_results);
+
 static int __init ego_kobject_init(void)
 {
     int ret = 0;
@@ -111,20 +467,49 @@ static int __init ego_kobject_init(void)
     do {
         chip = kzalloc(sizeof(*chip), GFP_KERNEL);
         if (!chip) {
-            ret = ENOMEM;
+            ret = -ENOMEM;
             break;
         }
 
-        chip->name = "egoist";
-        chip->debug_on = true;
+        ret = ego_core_setup(&chip->core, "egoist", ego_free);
+        if (ret)
+            break;
+
+        mutex_init(&chip->lock);
+        seqcount_mutex_init(&chip->seq, &chip->lock);
+        mutex_init(&chip->run_lock);
+        init_completion(&chip->ready);
+        init_completion(&chip->start);
+        chip->duration_ms = 1000;
+        chip->nr_writers = 1;
+        chip->workers = kcalloc(nr_cpu_ids, sizeof(*chip->workers), GFP_KERNEL);
+        if (!chip->workers) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        chip->stat_stores = ego_counter_create(chip->core.stats, "stores");
+        chip->stat_val = ego_gauge_create(chip->core.stats, "obj_val");
+
+        chip->kset = kset_create_and_add("ego_kset", NULL, NULL);
+        if (!chip->kset) {
+            ret = -ENOMEM;
+            break;
+        }
+        ret = ego_core_add_action(&chip->core, ego_kset_del, chip->kset);
+        if (ret)
+            break;
 
         chip->kobj.ktype = &k_type;
-        chip->kobj.kset = kset_create_and_add("ego_kset", NULL, NULL);
-        ret = kobject_init_and_add(&chip->kobj, chip->kobj.ktype, NULL, "%s", chip->name);
+        chip->kobj.kset = chip->kset;
+        ret = kobject_init_and_add(&chip->kobj, chip->kobj.ktype, NULL, "%s", chip->core.name);
         if (ret) {
             ego_err(chip, "Could not register\n");
             break;
         }
+        ret = ego_core_add_action(&chip->core, ego_kobj_del, chip);
+        if (ret)
+            break;
         ret = sysfs_create_files(&chip->kobj, (const struct attribute **)self_attr);
         if (ret) {
 		    ret = -ENOMEM;
@@ -136,6 +521,11 @@ static int __init ego_kobject_init(void)
 
         kobject_uevent(&chip->kobj, KOBJ_CHANGE);
 
+        debugfs_create_u32("duration_ms", 0644, chip->core.dir, &chip->duration_ms);
+        debugfs_create_u32("nr_writers", 0644, chip->core.dir, &chip->nr_writers);
+        debugfs_create_file("run", 0200, chip->core.dir, chip, &kobj_run_fops);
+        debugfs_create_file("results", 0444, chip->core.dir, chip, &kobj_results_fops);
+
     } while (0);
 
     if (ret) {
@@ -0,0 +1,1082 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/platform_device.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/uaccess.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/delay.h>
+#include <linux/sizes.h>
+#include <linux/irq_work.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/uio.h>
+#include <linux/bvec.h>
+#include <linux/poll.h>
+#include <linux/completion.h>
+
+#include "virtual_dev.h"
+#include "egoist.h"
+#include "ego_pool.h"
+
+enum {
+    VDEV_HW_KTHREAD = 0,    /* a kthread plays the hardware */
+    VDEV_HW_HRTIMER,        /* a soft hrtimer plays the hardware */
+};
+
+static int hw_mode = VDEV_HW_KTHREAD;
+module_param(hw_mode, int, 0444);
+MODULE_PARM_DESC(hw_mode, "0: kthread engine, 1: hrtimer engine");
+
+static unsigned int queue_depth = 256;
+module_param(queue_depth, uint, 0444);
+MODULE_PARM_DESC(queue_depth, "SQ/CQ entries, rounded up to a power of two");
+
+static unsigned int buf_size = SZ_1M;
+module_param(buf_size, uint, 0444);
+MODULE_PARM_DESC(buf_size, "Shared data buffer in bytes");
+
+static unsigned int dev_size = SZ_1M;
+module_param(dev_size, uint, 0444);
+MODULE_PARM_DESC(dev_size, "Emulated device memory in bytes");
+
+static unsigned int hw_budget = 64;
+module_param(hw_budget, uint, 0644);
+MODULE_PARM_DESC(hw_budget, "SQEs the hardware consumes per pass");
+
+static unsigned int hw_delay_ns;
+module_param(hw_delay_ns, uint, 0644);
+MODULE_PARM_DESC(hw_delay_ns, "Emulated service time per pass");
+
+static unsigned int coal_irq_thresh = 16;
+module_param(coal_irq_thresh, uint, 0644);
+MODULE_PARM_DESC(coal_irq_thresh, "Interrupts per window before switching to polling");
+
+static unsigned int coal_window_us = 1000;
+module_param(coal_window_us, uint, 0644);
+MODULE_PARM_DESC(coal_window_us, "Sample window of the interrupt rate");
+
+static unsigned int poll_budget = 64;
+module_param(poll_budget, uint, 0644);
+MODULE_PARM_DESC(poll_budget, "Completions handled per poll before yielding");
+
+static unsigned int zc_threshold = SZ_64K;
+module_param(zc_threshold, uint, 0644);
+MODULE_PARM_DESC(zc_threshold, "read/write size from which user pages are pinned instead of bounced");
+
+/* Bounce buffers up to this size come from the per-CPU pool, not kvmalloc */
+#define VDEV_BOUNCE_POOLED  PAGE_SIZE
+
+#define VDEV_LAT_BUCKETS    32  /* log2(ns) */
+
+/*
+ * A read()/write() on the device is carried by a kernel request that the
+ * hardware moves between the caller's memory and the device FIFO. Small
+ * transfers go through a bounce buffer, large ones pin the user pages and
+ * the hardware copies straight into them.
+ */
+struct vdev_kreq {
+    struct list_head node;
+    int op;                     /* VDEV_OP_WRITE or VDEV_OP_READ */
+    u64 fifo_pos;
+    size_t len;
+    size_t res;
+    struct iov_iter iter;       /* what the hardware copies from/to */
+    struct kvec kvec;
+    void *bounce;
+    bool pooled;                /* bounce came from chip->bounce_pool */
+    struct bio_vec *bvec;
+    struct page **pages;
+    unsigned int nr_pages;
+    bool pinned;
+    struct completion done;
+};
+
+struct vdev_stats {
+    atomic_long_t doorbells;
+    unsigned long passes;       /* written by the hardware context only */
+    unsigned long consumed;
+    unsigned long completed;
+    unsigned long cq_full;
+    unsigned long bad_sq;
+    unsigned long irq_raised;
+    unsigned long irq_merged;   /* raised while the previous one was pending */
+    unsigned long irq_masked;   /* suppressed while polling */
+
+    /* Below are written under reap_lock */
+    unsigned long irqs;
+    unsigned long irq_events;
+    unsigned long polls;
+    unsigned long poll_events;
+    unsigned long to_poll;
+    unsigned long to_irq;
+    u64 lat_sum;
+    u64 lat_max;
+    unsigned long lat_hist[VDEV_LAT_BUCKETS];
+
+    atomic_long_t kreqs;
+    atomic_long_t zc_bytes;
+    atomic_long_t bounce_bytes;
+};
+
+typedef struct _egoist {
+    struct ego_core core;
+    struct platform_device *pdev;
+    struct miscdevice misc;
+    bool misc_registered;
+
+    /* Shared memory: rings, entries and the data buffer */
+    void *shm;
+    struct vdev_info info;
+    struct vdev_ring *sq;
+    struct vdev_ring *cq;
+    struct vdev_sqe *sqes;
+    struct vdev_cqe *cqes;
+    u8 *buf;
+    u8 *dev_mem;
+    u32 mask;
+
+    /* Private copies of the indexes owned by the hardware */
+    u32 sq_head;
+    u32 cq_tail;
+    u64 *cq_stamp;              /* when the hardware posted each CQE */
+
+    struct mutex submit_lock;
+    wait_queue_head_t cq_wait;
+
+    /* Device FIFO behind read()/write(), positions only ever grow */
+    u8 *fifo;
+    u32 fifo_mask;
+    u64 fifo_head;
+    u64 fifo_tail;
+    struct mutex rd_lock;
+    struct mutex wr_lock;
+    wait_queue_head_t fifo_wait;
+    spinlock_t kreq_lock;
+    struct list_head kreq_list;
+
+    /* Emulated hardware */
+    atomic_t doorbell;
+    struct task_struct *hw_thread;
+    wait_queue_head_t hw_wait;
+    struct hrtimer hw_timer;
+
+    /* Interrupt side, cq_seen and the rate window are under reap_lock */
+    struct irq_work irq_work;
+    struct work_struct poll_work;
+    spinlock_t reap_lock;
+    u32 cq_seen;
+    u64 win_start;
+    unsigned int win_irqs;
+    bool polling;               /* interrupts masked, poll_work owns the CQ */
+    bool dying;
+
+    struct vdev_stats stats;
+    struct ego_pool *bounce_pool;
+    struct ego_stat *stat_events;
+    struct ego_stat *stat_notify;
+}egoist, *pegoist;
+pegoist chip;
+
+static inline bool vdev_range_ok(u64 off, u32 len, u32 size)
+{
+    return len <= size && off <= size - len;
+}
+
+static int vdev_hw_exec(pegoist chip, const struct vdev_sqe *sqe)
+{
+    switch (sqe->opcode) {
+    case VDEV_OP_NOP:
+        return 0;
+    case VDEV_OP_WRITE:
+    case VDEV_OP_READ:
+        if (!vdev_range_ok(sqe->buf_off, sqe->len, chip->info.buf_size) ||
+            !vdev_range_ok(sqe->dev_off, sqe->len, chip->info.dev_size))
+            return -EINVAL;
+
+        if (sqe->opcode == VDEV_OP_WRITE)
+            memcpy(chip->dev_mem + sqe->dev_off, chip->buf + sqe->buf_off, sqe->len);
+        else
+            memcpy(chip->buf + sqe->buf_off, chip->dev_mem + sqe->dev_off, sqe->len);
+        return sqe->len;
+    default:
+        return -EOPNOTSUPP;
+    }
+}
+
+/*
+ * The hardware asserts its interrupt once per completion unless the driver
+ * masked it for polling. A raise while the previous one is still pending is
+ * merged, the same as a level-triggered line that is already high.
+ */
+static void vdev_raise_irq(pegoist chip)
+{
+    /* Publish the CQ tail before sampling the mask, pairs with poll exit */
+    smp_mb();
+    if (READ_ONCE(chip->polling)) {
+        chip->stats.irq_masked++;
+        return;
+    }
+
+    if (irq_work_queue(&chip->irq_work))
+        chip->stats.irq_raised++;
+    else
+        chip->stats.irq_merged++;
+}
+
+static inline bool vdev_cq_pending(pegoist chip)
+{
+    return smp_load_acquire(&chip->cq_tail) != READ_ONCE(chip->cq_seen);
+}
+
+static void vdev_lat_account(pegoist chip, u64 lat)
+{
+    struct vdev_stats *st = &chip->stats;
+
+    st->lat_sum += lat;
+    if (lat > st->lat_max)
+        st->lat_max = lat;
+    st->lat_hist[min_t(unsigned int, lat ? ilog2(lat) : 0, VDEV_LAT_BUCKETS - 1)]++;
+}
+
+/*
+ * Driver side of a completion: account how long each CQE waited for the
+ * driver to notice it and wake whoever sleeps on the CQ. Returns the number
+ * of CQEs handled, at most @budget.
+ */
+static unsigned int vdev_reap(pegoist chip, unsigned int budget, bool from_irq)
+{
+    unsigned long flags;
+    u32 tail, seen, n, i;
+    u64 now, stamp, lat;
+
+    spin_lock_irqsave(&chip->reap_lock, flags);
+    tail = smp_load_acquire(&chip->cq_tail);
+    /* Only after the tail, so every stamp we read is older than now */
+    now = ktime_get_ns();
+    seen = chip->cq_seen;
+    if (tail - seen > chip->info.entries)
+        seen = tail - chip->info.entries;   /* stamps already reused */
+
+    n = min(tail - seen, budget);
+    for (i = 0; i < n; i++) {
+        /* A slot may be restamped by a later CQE meanwhile, never wrap */
+        stamp = READ_ONCE(chip->cq_stamp[(seen + i) & chip->mask]);
+        lat = now > stamp ? now - stamp : 0;
+        vdev_lat_account(chip, lat);
+        ego_hist_record(chip->stat_notify, lat);
+    }
+    ego_counter_add(chip->stat_events, n);
+    WRITE_ONCE(chip->cq_seen, seen + n);
+
+    if (from_irq)
+        chip->stats.irq_events += n;
+    else
+        chip->stats.poll_events += n;
+    spin_unlock_irqrestore(&chip->reap_lock, flags);
+
+    if (n)
+        wake_up_interruptible(&chip->cq_wait);
+
+    return n;
+}
+
+static void vdev_irq_handler(struct irq_work *work)
+{
+    pegoist dev = container_of(work, egoist, irq_work);
+    u64 now = ktime_get_ns();
+    bool storm;
+
+    if (READ_ONCE(dev->dying) || READ_ONCE(dev->polling))
+        return;
+
+    spin_lock(&dev->reap_lock);
+    dev->stats.irqs++;
+    if (now - dev->win_start > (u64)READ_ONCE(coal_window_us) * NSEC_PER_USEC) {
+        dev->win_start = now;
+        dev->win_irqs = 0;
+    }
+    storm = ++dev->win_irqs > READ_ONCE(coal_irq_thresh);
+    if (storm) {
+        /* Too many interrupts in this window: mask and poll instead */
+        WRITE_ONCE(dev->polling, true);
+        dev->stats.to_poll++;
+    }
+    spin_unlock(&dev->reap_lock);
+
+    if (storm)
+        queue_work(system_highpri_wq, &dev->poll_work);
+    else
+        vdev_reap(dev, UINT_MAX, true);
+}
+
+static void vdev_poll_work(struct work_struct *work)
+{
+    pegoist dev = container_of(work, egoist, poll_work);
+    unsigned int budget = max(READ_ONCE(poll_budget), 1U);
+    unsigned int n;
+
+    n = vdev_reap(dev, budget, false);
+
+    spin_lock_irq(&dev->reap_lock);
+    dev->stats.polls++;
+    if (n < budget) {
+        WRITE_ONCE(dev->polling, false);
+        dev->win_irqs = 0;
+        dev->stats.to_irq++;
+    }
+    spin_unlock_irq(&dev->reap_lock);
+
+    if (READ_ONCE(dev->dying))
+        return;
+
+    if (n == budget) {
+        /* Still busy, stay in polling mode and let others run first */
+        queue_work(system_highpri_wq, &dev->poll_work);
+        return;
+    }
+
+    /*
+     * Interrupts are back on. A CQE posted while we were still masked did
+     * not raise one, so raise it ourselves rather than leave it stranded.
+     */
+    smp_mb();
+    if (vdev_cq_pending(dev))
+        irq_work_queue(&dev->irq_work);
+}
+
+static void vdev_hw_kreq(pegoist chip, struct vdev_kreq *rq)
+{
+    u32 off = rq->fifo_pos & chip->fifo_mask;
+    size_t first = min_t(size_t, rq->len, chip->fifo_mask + 1 - off);
+    size_t n;
+
+    if (rq->op == VDEV_OP_WRITE) {
+        n = copy_from_iter(chip->fifo + off, first, &rq->iter);
+        if (n == first && rq->len > first)
+            n += copy_from_iter(chip->fifo, rq->len - first, &rq->iter);
+    } else {
+        n = copy_to_iter(chip->fifo + off, first, &rq->iter);
+        if (n == first && rq->len > first)
+            n += copy_to_iter(chip->fifo, rq->len - first, &rq->iter);
+    }
+
+    rq->res = n;
+    complete(&rq->done);
+}
+
+/* Kernel requests bypass the rings and complete straight to the caller */
+static void vdev_hw_kreqs(pegoist chip)
+{
+    struct vdev_kreq *rq, *tmp;
+    LIST_HEAD(list);
+
+    spin_lock_bh(&chip->kreq_lock);
+    list_splice_init(&chip->kreq_list, &list);
+    spin_unlock_bh(&chip->kreq_lock);
+
+    list_for_each_entry_safe(rq, tmp, &list, node)
+        vdev_hw_kreq(chip, rq);
+}
+
+/*
+ * One pass of the hardware: consume up to @budget SQEs and post their CQEs.
+ * Only one hardware context runs at a time, so sq_head/cq_tail need no lock.
+ * Returns the number of SQEs consumed; a short count means the SQ is empty
+ * or the CQ is full, and in both cases the next doorbell restarts us.
+ */
+static unsigned int vdev_hw_process(pegoist chip, unsigned int budget)
+{
+    u32 sq_head = chip->sq_head;
+    u32 cq_tail = chip->cq_tail;
+    u32 sq_tail = smp_load_acquire(&chip->sq->tail);
+    u32 cq_head = smp_load_acquire(&chip->cq->head);
+    unsigned int done = 0;
+    struct vdev_sqe sqe;
+    struct vdev_cqe *cqe;
+    u64 now = ktime_get_ns();
+
+    vdev_hw_kreqs(chip);
+
+    if (sq_tail - sq_head > chip->info.entries) {
+        /* Userspace scribbled over the tail, drop the whole window */
+        chip->stats.bad_sq++;
+        chip->sq_head = sq_tail;
+        smp_store_release(&chip->sq->head, sq_tail);
+        return 0;
+    }
+
+    while (sq_head != sq_tail && done < budget) {
+        if (cq_tail - cq_head >= chip->info.entries) {
+            chip->stats.cq_full++;
+            break;
+        }
+
+        /* Snapshot the SQE, userspace may rewrite the slot at any time */
+        memcpy(&sqe, &chip->sqes[sq_head & chip->mask], sizeof(sqe));
+
+        cqe = &chip->cqes[cq_tail & chip->mask];
+        cqe->user_data = sqe.user_data;
+        cqe->res = vdev_hw_exec(chip, &sqe);
+        cqe->flags = 0;
+        chip->cq_stamp[cq_tail & chip->mask] = now;
+
+        sq_head++;
+        cq_tail++;
+        done++;
+
+        /* Post each CQE on its own so every completion can interrupt */
+        smp_store_release(&chip->cq->tail, cq_tail);
+        smp_store_release(&chip->cq_tail, cq_tail);
+        vdev_raise_irq(chip);
+    }
+
+    chip->sq_head = sq_head;
+    smp_store_release(&chip->sq->head, sq_head);
+
+    chip->stats.passes++;
+    chip->stats.consumed += done;
+    chip->stats.completed += done;
+
+    return done;
+}
+
+static int vdev_hw_thread(void *data)
+{
+    pegoist dev = data;
+    unsigned int budget;
+
+    ego_info(dev, "Enter\n");
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(dev->hw_wait,
+                atomic_read(&dev->doorbell) || kthread_should_stop());
+        if (!atomic_xchg(&dev->doorbell, 0))
+            continue;
+
+        do {
+            if (hw_delay_ns)
+                ndelay(hw_delay_ns);
+            budget = max(READ_ONCE(hw_budget), 1U);
+            cond_resched();
+        } while (vdev_hw_process(dev, budget) == budget);
+    }
+    ego_info(dev, "Exit\n");
+
+    return 0;
+}
+
+static enum hrtimer_restart vdev_hw_timer(struct hrtimer *timer)
+{
+    pegoist dev = container_of(timer, egoist, hw_timer);
+    unsigned int budget = max(READ_ONCE(hw_budget), 1U);
+
+    atomic_set(&dev->doorbell, 0);
+    if (vdev_hw_process(dev, budget) < budget)
+        return HRTIMER_NORESTART;
+
+    /* Budget exhausted, come back for the rest after another service time */
+    atomic_set(&dev->doorbell, 1);
+    hrtimer_forward_now(timer, ns_to_ktime(READ_ONCE(hw_delay_ns)));
+    return HRTIMER_RESTART;
+}
+
+static void vdev_doorbell(pegoist chip)
+{
+    atomic_long_inc(&chip->stats.doorbells);
+
+    if (hw_mode == VDEV_HW_HRTIMER) {
+        if (!atomic_xchg(&chip->doorbell, 1))
+            hrtimer_start(&chip->hw_timer, ns_to_ktime(READ_ONCE(hw_delay_ns)),
+                    HRTIMER_MODE_REL_SOFT);
+    } else {
+        atomic_set(&chip->doorbell, 1);
+        wake_up_interruptible(&chip->hw_wait);
+    }
+}
+
+static inline u32 vdev_cq_ready(pegoist chip)
+{
+    return smp_load_acquire(&chip->cq->tail) - READ_ONCE(chip->cq->head);
+}
+
+static long vdev_submit(pegoist chip, struct vdev_submit __user *argp)
+{
+    struct vdev_submit sub;
+    struct vdev_sqe __user *src;
+    u32 head, tail, space, nr, idx, chunk;
+    long ret = 0;
+
+    if (copy_from_user(&sub, argp, sizeof(sub)))
+        return -EFAULT;
+
+    src = u64_to_user_ptr(sub.sqes);
+    if (sub.nr) {
+        mutex_lock(&chip->submit_lock);
+        head = smp_load_acquire(&chip->sq->head);
+        tail = READ_ONCE(chip->sq->tail);
+        space = chip->info.entries - (tail - head);
+        if (space > chip->info.entries)
+            space = 0;
+        nr = min(sub.nr, space);
+
+        /* At most two copies, one per side of the ring wrap */
+        while (ret < nr) {
+            idx = (tail + ret) & chip->mask;
+            chunk = min_t(u32, nr - ret, chip->info.entries - idx);
+            if (copy_from_user(&chip->sqes[idx], src + ret, chunk * sizeof(*src)))
+                break;
+            ret += chunk;
+        }
+
+        smp_store_release(&chip->sq->tail, tail + (u32)ret);
+        mutex_unlock(&chip->submit_lock);
+
+        if (!ret && nr)
+            return -EFAULT;
+    }
+
+    vdev_doorbell(chip);
+
+    if (sub.min_complete) {
+        sub.min_complete = min(sub.min_complete, chip->info.entries);
+        if (wait_event_interruptible(chip->cq_wait,
+                    vdev_cq_ready(chip) >= sub.min_complete))
+            return ret ? ret : -ERESTARTSYS;
+    }
+
+    return ret;
+}
+
+static long vdev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    pegoist dev = container_of(filp->private_data, egoist, misc);
+
+    switch (cmd) {
+    case VDEV_IOC_INFO:
+        if (copy_to_user((void __user *)arg, &dev->info, sizeof(dev->info)))
+            return -EFAULT;
+        return 0;
+    case VDEV_IOC_SUBMIT:
+        return vdev_submit(dev, (struct vdev_submit __user *)arg);
+    case VDEV_IOC_DOORBELL:
+        vdev_doorbell(dev);
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+static int vdev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    pegoist dev = container_of(filp->private_data, egoist, misc);
+
+    return remap_vmalloc_range(vma, dev->shm, vma->vm_pgoff);
+}
+
+static inline u64 vdev_fifo_avail(pegoist chip)
+{
+    return smp_load_acquire(&chip->fifo_tail) - smp_load_acquire(&chip->fifo_head);
+}
+
+static inline u64 vdev_fifo_space(pegoist chip)
+{
+    return chip->fifo_mask + 1 - vdev_fifo_avail(chip);
+}
+
+static void vdev_kreq_release(pegoist chip, struct vdev_kreq *rq)
+{
+    if (rq->pinned)
+        unpin_user_pages_dirty_lock(rq->pages, rq->nr_pages, rq->op == VDEV_OP_READ);
+    kvfree(rq->pages);
+    kvfree(rq->bvec);
+    if (rq->pooled)
+        ego_pool_free(chip->bounce_pool, rq->bounce);
+    else
+        kvfree(rq->bounce);
+}
+
+/* Pin the first @len bytes of @ui and describe them to the hardware */
+static ssize_t vdev_kreq_pin(struct vdev_kreq *rq, struct iov_iter *ui, size_t len)
+{
+    size_t count = iov_iter_count(ui);
+    unsigned int maxpages, i;
+    size_t done = 0, off, bytes;
+    struct page **pages;
+    ssize_t ret;
+
+    iov_iter_truncate(ui, len);
+    maxpages = iov_iter_npages(ui, INT_MAX);
+    rq->pages = kvmalloc_array(maxpages, sizeof(*rq->pages), GFP_KERNEL);
+    rq->bvec = kvmalloc_array(maxpages, sizeof(*rq->bvec), GFP_KERNEL);
+    if (!rq->pages || !rq->bvec) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    rq->pinned = iov_iter_extract_will_pin(ui);
+    while (iov_iter_count(ui) && rq->nr_pages < maxpages) {
+        pages = rq->pages + rq->nr_pages;
+        ret = iov_iter_extract_pages(ui, &pages, SIZE_MAX,
+                maxpages - rq->nr_pages, 0, &off);
+        if (ret <= 0)
+            break;
+
+        for (bytes = ret, i = 0; bytes; i++) {
+            size_t seg = min_t(size_t, bytes, PAGE_SIZE - off);
+
+            bvec_set_page(&rq->bvec[rq->nr_pages + i], pages[i], seg, off);
+            bytes -= seg;
+            off = 0;
+        }
+        rq->nr_pages += i;
+        done += ret;
+    }
+
+    ret = done ? done : -EFAULT;
+    if (done)
+        iov_iter_bvec(&rq->iter, rq->op == VDEV_OP_WRITE ? ITER_SOURCE : ITER_DEST,
+                rq->bvec, rq->nr_pages, done);
+out:
+    iov_iter_reexpand(ui, count - done);
+    return ret;
+}
+
+/*
+ * Hand @len bytes between @ui and the FIFO at @pos to the hardware and wait
+ * for it. Returns the bytes moved or -errno, @ui is advanced accordingly.
+ */
+static ssize_t vdev_kreq_run(pegoist chip, int op, struct iov_iter *ui, u64 pos, size_t len)
+{
+    struct vdev_kreq rq = {
+        .op = op,
+        .fifo_pos = pos,
+    };
+    ssize_t ret;
+
+    init_completion(&rq.done);
+    if (len >= READ_ONCE(zc_threshold)) {
+        ret = vdev_kreq_pin(&rq, ui, len);
+        if (ret < 0)
+            goto out;
+        rq.len = ret;
+        atomic_long_add(ret, &chip->stats.zc_bytes);
+    } else {
+        rq.pooled = len <= VDEV_BOUNCE_POOLED;
+        if (rq.pooled)
+            rq.bounce = ego_pool_alloc(chip->bounce_pool, GFP_KERNEL);
+        else
+            rq.bounce = kvmalloc(len, GFP_KERNEL);
+        if (!rq.bounce)
+            return -ENOMEM;
+        rq.len = len;
+        if (op == VDEV_OP_WRITE) {
+            rq.len = copy_from_iter(rq.bounce, len, ui);
+            if (!rq.len) {
+                ret = -EFAULT;
+                goto out;
+            }
+        }
+        rq.kvec.iov_base = rq.bounce;
+        rq.kvec.iov_len = rq.len;
+        iov_iter_kvec(&rq.iter, op == VDEV_OP_WRITE ? ITER_SOURCE : ITER_DEST,
+                &rq.kvec, 1, rq.len);
+        atomic_long_add(rq.len, &chip->stats.bounce_bytes);
+    }
+
+    spin_lock_bh(&chip->kreq_lock);
+    list_add_tail(&rq.node, &chip->kreq_list);
+    spin_unlock_bh(&chip->kreq_lock);
+    atomic_long_inc(&chip->stats.kreqs);
+    vdev_doorbell(chip);
+
+    /* The hardware owns our pages until it completes, no bailing out */
+    wait_for_completion(&rq.done);
+    ret = rq.res;
+
+    if (op == VDEV_OP_READ && rq.bounce && ret > 0) {
+        ret = copy_to_iter(rq.bounce, ret, ui);
+        if (!ret)
+            ret = -EFAULT;
+    }
+out:
+    vdev_kreq_release(chip, &rq);
+    return ret;
+}
+
+static int vdev_lock_io(struct mutex *lock, bool nowait)
+{
+    if (nowait)
+        return mutex_trylock(lock) ? 0 : -EAGAIN;
+    return mutex_lock_interruptible(lock);
+}
+
+static ssize_t vdev_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    pegoist dev = container_of(iocb->ki_filp->private_data, egoist, misc);
+    bool nowait = (iocb->ki_flags & IOCB_NOWAIT) || (iocb->ki_filp->f_flags & O_NONBLOCK);
+    u64 avail, head;
+    ssize_t ret;
+
+    if (!iov_iter_count(to))
+        return 0;
+
+    ret = vdev_lock_io(&dev->rd_lock, nowait);
+    if (ret)
+        return ret;
+
+    avail = vdev_fifo_avail(dev);
+    if (!avail) {
+        if (nowait) {
+            ret = -EAGAIN;
+            goto unlock;
+        }
+        ret = wait_event_interruptible(dev->fifo_wait, vdev_fifo_avail(dev));
+        if (ret)
+            goto unlock;
+        avail = vdev_fifo_avail(dev);
+    }
+
+    /* A read returns whatever is there, it never waits to fill the buffer */
+    head = dev->fifo_head;
+    ret = vdev_kreq_run(dev, VDEV_OP_READ, to, head,
+            min_t(u64, avail, iov_iter_count(to)));
+    if (ret > 0) {
+        smp_store_release(&dev->fifo_head, head + ret);
+        wake_up_interruptible(&dev->fifo_wait);
+    }
+unlock:
+    mutex_unlock(&dev->rd_lock);
+    return ret;
+}
+
+static ssize_t vdev_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    pegoist dev = container_of(iocb->ki_filp->private_data, egoist, misc);
+    bool nowait = (iocb->ki_flags & IOCB_NOWAIT) || (iocb->ki_filp->f_flags & O_NONBLOCK);
+    ssize_t written = 0, ret;
+    u64 space, tail;
+
+    if (!iov_iter_count(from))
+        return 0;
+
+    ret = vdev_lock_io(&dev->wr_lock, nowait);
+    if (ret)
+        return ret;
+
+    /* Like a pipe, a blocking write only returns once everything is in */
+    while (iov_iter_count(from)) {
+        space = vdev_fifo_space(dev);
+        if (!space) {
+            if (nowait) {
+                ret = -EAGAIN;
+                break;
+            }
+            ret = wait_event_interruptible(dev->fifo_wait, vdev_fifo_space(dev));
+            if (ret)
+                break;
+            space = vdev_fifo_space(dev);
+        }
+
+        tail = dev->fifo_tail;
+        ret = vdev_kreq_run(dev, VDEV_OP_WRITE, from, tail,
+                min_t(u64, space, iov_iter_count(from)));
+        if (ret <= 0)
+            break;
+
+        smp_store_release(&dev->fifo_tail, tail + ret);
+        wake_up_interruptible(&dev->fifo_wait);
+        written += ret;
+    }
+    mutex_unlock(&dev->wr_lock);
+
+    return written ? written : ret;
+}
+
+static __poll_t vdev_poll(struct file *filp, poll_table *wait)
+{
+    pegoist dev = container_of(filp->private_data, egoist, misc);
+    __poll_t mask = 0;
+
+    poll_wait(filp, &dev->fifo_wait, wait);
+    poll_wait(filp, &dev->cq_wait, wait);
+
+    if (vdev_fifo_avail(dev))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (vdev_fifo_space(dev))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    if (vdev_cq_ready(dev))
+        mask |= EPOLLRDBAND;    /* CQEs waiting to be reaped */
+
+    return mask;
+}
+
+static int vdev_open(struct inode *inode, struct file *filp)
+{
+    /*
+     * No FMODE_NOWAIT: a transfer always sleeps on the hardware, so
+     * io_uring hands our reads and writes to io-wq instead of trying inline
+     */
+    return stream_open(inode, filp);
+}
+
+static const struct file_operations vdev_fops = {
+    .owner = THIS_MODULE,
+    .open = vdev_open,
+    .read_iter = vdev_read_iter,
+    .write_iter = vdev_write_iter,
+    .poll = vdev_poll,
+    .unlocked_ioctl = vdev_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .mmap = vdev_mmap,
+};
+
+static int vdev_stats_show(struct seq_file *m, void *v)
+{
+    pegoist dev = m->private;
+    struct vdev_stats *st = &dev->stats;
+    struct vdev_stats snap;
+    unsigned long events;
+    int i;
+
+    seq_printf(m, "doorbells:%ld\n", atomic_long_read(&dev->stats.doorbells));
+    seq_printf(m, "passes:%lu\n", READ_ONCE(dev->stats.passes));
+    seq_printf(m, "consumed:%lu\n", READ_ONCE(dev->stats.consumed));
+    seq_printf(m, "completed:%lu\n", READ_ONCE(dev->stats.completed));
+    seq_printf(m, "cq_full:%lu\n", READ_ONCE(dev->stats.cq_full));
+    seq_printf(m, "bad_sq:%lu\n", READ_ONCE(dev->stats.bad_sq));
+    seq_printf(m, "sq_head:%u sq_tail:%u\n",
+            READ_ONCE(dev->sq->head), READ_ONCE(dev->sq->tail));
+    seq_printf(m, "cq_head:%u cq_tail:%u\n",
+            READ_ONCE(dev->cq->head), READ_ONCE(dev->cq->tail));
+    seq_printf(m, "fifo_head:%llu fifo_tail:%llu\n",
+            READ_ONCE(dev->fifo_head), READ_ONCE(dev->fifo_tail));
+    seq_printf(m, "kreqs:%ld zc_bytes:%ld bounce_bytes:%ld\n",
+            atomic_long_read(&st->kreqs), atomic_long_read(&st->zc_bytes),
+            atomic_long_read(&st->bounce_bytes));
+    seq_printf(m, "mode:%s\n", READ_ONCE(dev->polling) ? "poll" : "irq");
+    seq_printf(m, "irq_raised:%lu irq_merged:%lu irq_masked:%lu\n",
+            READ_ONCE(st->irq_raised), READ_ONCE(st->irq_merged),
+            READ_ONCE(st->irq_masked));
+
+    spin_lock_irq(&dev->reap_lock);
+    snap = *st;
+    spin_unlock_irq(&dev->reap_lock);
+
+    events = snap.irq_events + snap.poll_events;
+    seq_printf(m, "irqs:%lu irq_events:%lu events_per_irq:%lu.%02lu\n",
+            snap.irqs, snap.irq_events,
+            snap.irqs ? snap.irq_events / snap.irqs : 0,
+            snap.irqs ? snap.irq_events * 100 / snap.irqs % 100 : 0);
+    seq_printf(m, "polls:%lu poll_events:%lu events_per_poll:%lu.%02lu\n",
+            snap.polls, snap.poll_events,
+            snap.polls ? snap.poll_events / snap.polls : 0,
+            snap.polls ? snap.poll_events * 100 / snap.polls % 100 : 0);
+    seq_printf(m, "to_poll:%lu to_irq:%lu\n", snap.to_poll, snap.to_irq);
+    seq_printf(m, "lat_avg_ns:%llu lat_max_ns:%llu\n",
+            events ? div64_u64(snap.lat_sum, events) : 0, snap.lat_max);
+    for (i = 0; i < VDEV_LAT_BUCKETS; i++) {
+        if (snap.lat_hist[i])
+            seq_printf(m, "lat_ns[%llu]:%lu\n", 1ULL << i, snap.lat_hist[i]);
+    }
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(vdev_stats);
+
+static int vdev_shm_init(pegoist chip)
+{
+    struct vdev_info *info = &chip->info;
+    size_t off;
+
+    info->entries = roundup_pow_of_two(clamp(queue_depth, 2U, 32768U));
+    info->buf_size = PAGE_ALIGN(max(buf_size, (unsigned int)PAGE_SIZE));
+    info->dev_size = max(dev_size, (unsigned int)PAGE_SIZE);
+
+    off = 0;
+    info->sq_off = off;
+    off += sizeof(struct vdev_ring);
+    info->cq_off = off;
+    off += sizeof(struct vdev_ring);
+    info->sqes_off = ALIGN(off, SMP_CACHE_BYTES);
+    off = info->sqes_off + info->entries * sizeof(struct vdev_sqe);
+    info->cqes_off = ALIGN(off, SMP_CACHE_BYTES);
+    off = info->cqes_off + info->entries * sizeof(struct vdev_cqe);
+    info->buf_off = PAGE_ALIGN(off);
+    info->mmap_size = info->buf_off + info->buf_size;
+
+    chip->shm = vmalloc_user(info->mmap_size);
+    if (!chip->shm)
+        return -ENOMEM;
+
+    chip->dev_mem = vzalloc(info->dev_size);
+    if (!chip->dev_mem)
+        return -ENOMEM;
+
+    chip->fifo = vzalloc(roundup_pow_of_two(info->dev_size));
+    if (!chip->fifo)
+        return -ENOMEM;
+    chip->fifo_mask = roundup_pow_of_two(info->dev_size) - 1;
+
+    chip->cq_stamp = kvcalloc(info->entries, sizeof(u64), GFP_KERNEL);
+    if (!chip->cq_stamp)
+        return -ENOMEM;
+
+    chip->sq = chip->shm + info->sq_off;
+    chip->cq = chip->shm + info->cq_off;
+    chip->sqes = chip->shm + info->sqes_off;
+    chip->cqes = chip->shm + info->cqes_off;
+    chip->buf = chip->shm + info->buf_off;
+    chip->mask = info->entries - 1;
+
+    return 0;
+}
+
+EGO_DEFINE_RELEASE(ego_free, egoist)
+
+void ego_release(pegoist chip)
+{
+    if (chip != NULL) {
+        ego_core_put(&chip->core);
+    } else {
+        pr_err("Failed to alloc mem for egoist\n");
+    }
+}
+
+static void vdev_teardown(void *data)
+{
+    pegoist chip = data;
+
+    /* No new users first, then stop the hardware, then free memory */
+    if (chip->misc_registered)
+        misc_deregister(&chip->misc);
+    if (!IS_ERR_OR_NULL(chip->hw_thread))
+        kthread_stop(chip->hw_thread);
+    hrtimer_cancel(&chip->hw_timer);
+    /* The hardware is quiet, now the interrupt and the poller */
+    WRITE_ONCE(chip->dying, true);
+    /*
+     * A handler already past its dying check may still queue poll_work,
+     * so drain it before cancelling; a poller that raced the flag may in
+     * turn raise one last, now harmless, irq_work.
+     */
+    irq_work_sync(&chip->irq_work);
+    cancel_work_sync(&chip->poll_work);
+    irq_work_sync(&chip->irq_work);
+    ego_pool_destroy(chip->bounce_pool);
+    kvfree(chip->cq_stamp);
+    vfree(chip->fifo);
+    vfree(chip->dev_mem);
+    vfree(chip->shm);
+    if (!IS_ERR_OR_NULL(chip->pdev))
+        platform_device_unregister(chip->pdev);
+}
+
+static int __init virtual_dev_init(void)
+{
+    int ret = 0;
+
+    do {
+        chip = kzalloc(sizeof(*chip), GFP_KERNEL);
+        if (!chip) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        ret = ego_core_setup(&chip->core, "virtual_dev", ego_free);
+        if (ret)
+            break;
+        mutex_init(&chip->submit_lock);
+        init_waitqueue_head(&chip->cq_wait);
+        init_waitqueue_head(&chip->hw_wait);
+        atomic_set(&chip->doorbell, 0);
+        hrtimer_init(&chip->hw_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+        chip->hw_timer.function = &vdev_hw_timer;
+        init_irq_work(&chip->irq_work, vdev_irq_handler);
+        INIT_WORK(&chip->poll_work, vdev_poll_work);
+        spin_lock_init(&chip->reap_lock);
+        mutex_init(&chip->rd_lock);
+        mutex_init(&chip->wr_lock);
+        init_waitqueue_head(&chip->fifo_wait);
+        spin_lock_init(&chip->kreq_lock);
+        INIT_LIST_HEAD(&chip->kreq_list);
+        ret = ego_core_add_action(&chip->core, vdev_teardown, chip);
+        if (ret)
+            break;
+
+        chip->pdev = platform_device_register_simple(VDEV_NAME, 0, NULL, 0);
+        if (IS_ERR(chip->pdev)) {
+            ret = PTR_ERR(chip->pdev);
+            ego_err(chip, "Failed to add platform device\n");
+            break;
+        }
+
+        chip->stat_events = ego_counter_create(chip->core.stats, "cq_events");
+        chip->stat_notify = ego_hist_create(chip->core.stats, "cq_notify_ns");
+
+        chip->bounce_pool = ego_pool_create(VDEV_BOUNCE_POOLED, 4, "%s_bounce",
+                chip->core.instance);
+        if (!chip->bounce_pool) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        ret = vdev_shm_init(chip);
+        if (ret) {
+            ego_err(chip, "Failed to alloc rings\n");
+            break;
+        }
+
+        if (hw_mode == VDEV_HW_KTHREAD) {
+            chip->hw_thread = kthread_run(vdev_hw_thread, chip, "vdev_hw");
+            if (IS_ERR(chip->hw_thread)) {
+                ret = PTR_ERR(chip->hw_thread);
+                break;
+            }
+        }
+
+        debugfs_create_file("stats", 0444, chip->core.dir, chip, &vdev_stats_fops);
+
+        chip->misc.minor = MISC_DYNAMIC_MINOR;
+        chip->misc.name = VDEV_NAME;
+        chip->misc.fops = &vdev_fops;
+        chip->misc.parent = &chip->pdev->dev;
+        ret = misc_register(&chip->misc);
+        if (ret) {
+            ego_err(chip, "Failed to register misc device\n");
+            break;
+        }
+        chip->misc_registered = true;
+
+    } while (0);
+
+    if (ret) {
+        ego_release(chip);
+        return ret;
+    }
+
+    ego_info(chip, "entries:%u buf:%u dev:%u mode:%d\n", chip->info.entries,
+            chip->info.buf_size, chip->info.dev_size, hw_mode);
+    return ret;
+}
+
+static void __exit virtual_dev_exit(void)
+{
+    ego_release(chip);
+    pr_info("virtual device removed\n");
+}
+
+module_init(virtual_dev_init);
+module_exit(virtual_dev_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Manfred <1259106665@qq.com>");
@@ -0,0 +1,76 @@
+#ifndef _VIRTUAL_DEV_H
+#define _VIRTUAL_DEV_H
+
+/*
+ * Layout shared between virtual_dev.ko and userspace.
+ *
+ * The device exposes one submission queue (SQ) and one completion queue (CQ)
+ * plus a data buffer, all in a single region mapped through mmap(offset 0).
+ * Userspace produces SQEs and moves sq->tail, the emulated hardware consumes
+ * them, moves sq->head, produces CQEs and moves cq->tail. Userspace reaps
+ * CQEs and moves cq->head. Both queues have vdev_info.entries slots.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define VDEV_NAME   "virtual_dev"
+
+enum {
+    VDEV_OP_NOP = 0,
+    VDEV_OP_WRITE,      /* data buffer -> device memory */
+    VDEV_OP_READ,       /* device memory -> data buffer */
+};
+
+struct vdev_ring {
+    __u32 head __attribute__((aligned(64)));
+    __u32 tail __attribute__((aligned(64)));
+};
+
+struct vdev_sqe {
+    __u8  opcode;
+    __u8  flags;
+    __u16 rsvd;
+    __u32 len;
+    __u64 buf_off;      /* offset into the shared data buffer */
+    __u64 dev_off;      /* offset into the device memory */
+    __u64 user_data;    /* handed back untouched in the CQE */
+};
+
+struct vdev_cqe {
+    __u64 user_data;
+    __s32 res;          /* bytes transferred or -errno */
+    __u32 flags;
+};
+
+struct vdev_info {
+    __u32 entries;      /* depth of both queues, power of two */
+    __u32 buf_size;
+    __u32 dev_size;
+    __u32 mmap_size;
+    __u32 sq_off;       /* offsets inside the mmap region */
+    __u32 cq_off;
+    __u32 sqes_off;
+    __u32 cqes_off;
+    __u32 buf_off;
+    __u32 rsvd;
+};
+
+/*
+ * Copy @nr SQEs from @sqes into the SQ and ring the doorbell once, then wait
+ * until at least @min_complete CQEs are ready. @nr == 0 only kicks the
+ * hardware, which is how a consumer restarts it after draining a full CQ.
+ * Returns the number of SQEs queued.
+ */
+struct vdev_submit {
+    __u64 sqes;
+    __u32 nr;
+    __u32 min_complete;
+};
+
+#define VDEV_IOC_MAGIC      'V'
+#define VDEV_IOC_INFO       _IOR(VDEV_IOC_MAGIC, 0, struct vdev_info)
+#define VDEV_IOC_SUBMIT     _IOW(VDEV_IOC_MAGIC, 1, struct vdev_submit)
+#define VDEV_IOC_DOORBELL   _IO(VDEV_IOC_MAGIC, 2)
+
+#endif /* _VIRTUAL_DEV_H */